@@ -0,0 +1,79 @@
+// Microbenchmark of the B-Tree node search kernels: `make bench && ./keysearch_bench`
+// Times every kernel the CPU supports on sorted int64_t arrays of several node sizes and checks it against the scalar loop.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "keysearch.h"
+
+#define BENCH_LOOKUPS 2000000 // Searches timed per kernel and node size
+#define BENCH_PROBES 4096     // Distinct search keys, cycled through
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void) {
+    const int sizes[] = { 8, 32, 101, 201, 401 }; // 201 keys is a full node at the default BTREE_ORDER
+    const int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    int64_t* probes = malloc(BENCH_PROBES * sizeof(int64_t));
+    if (probes == NULL) {
+        printf("Error: Memory allocation failed\n");
+        return 1;
+    }
+    srand(42);
+
+    printf("Selected kernel: %s\n", keysearch_kernel_name(keysearch_kernel()));
+    printf("%6s", "keys");
+    for (int k = 0; k < KEYSEARCH_KERNELS; k++) {
+        printf(" %12s", keysearch_kernel_name((KeySearchKernel)k));
+    }
+    printf("   (ns per search)\n");
+
+    for (int s = 0; s < num_sizes; s++) {
+        int n = sizes[s];
+        int64_t* keys = malloc(n * sizeof(int64_t));
+        if (keys == NULL) {
+            printf("Error: Memory allocation failed\n");
+            free(probes);
+            return 1;
+        }
+        for (int i = 0; i < n; i++) {
+            keys[i] = (int64_t)i * 3 - n; // Gaps between keys, so probes hit and miss
+        }
+        for (int i = 0; i < BENCH_PROBES; i++) {
+            probes[i] = (int64_t)(rand() % (3 * n + 4)) - n - 2; // Also below the first and above the last key
+        }
+
+        printf("%6d", n);
+        for (int k = 0; k < KEYSEARCH_KERNELS; k++) {
+            if (!keysearch_supported((KeySearchKernel)k)) {
+                printf(" %12s", "-");
+                continue;
+            }
+            for (int i = 0; i < BENCH_PROBES; i++) {
+                int expected = keysearch_with(KEYSEARCH_SCALAR, keys, n, probes[i]);
+                if (keysearch_with((KeySearchKernel)k, keys, n, probes[i]) != expected) {
+                    printf("\nError: %s returned a wrong slot for key %lld\n", keysearch_kernel_name((KeySearchKernel)k), (long long)probes[i]);
+                    free(keys);
+                    free(probes);
+                    return 1;
+                }
+            }
+            volatile long long sink = 0; // Keeps the searches from being optimised away
+            double start = now_seconds();
+            for (int i = 0; i < BENCH_LOOKUPS; i++) {
+                sink += keysearch_with((KeySearchKernel)k, keys, n, probes[i % BENCH_PROBES]);
+            }
+            double elapsed = now_seconds() - start;
+            printf(" %12.2f", elapsed * 1e9 / BENCH_LOOKUPS);
+        }
+        printf("\n");
+        free(keys);
+    }
+    free(probes);
+    return 0;
+}
@@ -0,0 +1,186 @@
+#define _XOPEN_SOURCE 700 // For nftw
+// Reader/writer benchmark of a shared table: `make bench && ./table_bench [readers] [writers] [seconds] [commit-delay-us]`
+// Reader threads look rows up with table_get_row and walk id ranges with table_scan_range while writer threads insert
+// and delete rows, each change waiting for its log sync. Prints the change rate, how many commits shared each sync,
+// and the reader rate and worst lookup latency, then checks every reader saw the rows no writer touches intact.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "table.h"
+
+#define BENCH_ROWS 20000      // Rows loaded up front; readers only look these up, writers never change them
+#define BENCH_SCAN_EVERY 100  // One range scan per this many lookups
+#define BENCH_SCAN_ROWS 200   // Rows per range scan
+#define BENCH_MAX_THREADS 64
+#define BENCH_WRITER_LIVE 64  // Rows each writer keeps inserted; past it, every insert is followed by a delete
+#define BENCH_CACHE_PAGES 2048 // Holds the whole table, so lookups time the locking rather than the disk
+
+typedef struct {
+    Table* table;
+    int id;        // Thread number, also the writer's offset into the ids above BENCH_ROWS
+    int writers;
+    long ops;
+    long errors;
+    double max_wait; // Slowest lookup, in seconds
+} BenchThread;
+
+static int stop; // Set by main when the run is over
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill_row(Row* row, int64_t id) {
+    memset(row, 0, sizeof(*row));
+    row->id = id;
+    snprintf(row->name, sizeof(row->name), "name%" PRId64, id);
+    snprintf(row->email, sizeof(row->email), "user%" PRId64 "@example.com", id);
+}
+
+static int row_matches(const Row* row, int64_t id) {
+    Row expected;
+    fill_row(&expected, id);
+    return row->id == id && strcmp(row->name, expected.name) == 0 && strcmp(row->email, expected.email) == 0;
+}
+
+static int count_row(const Row* row, RowLoc pos, void* arg) {
+    (void)pos;
+    long* count = arg;
+    *count += row_matches(row, row->id); // A wrong row makes the count come out short
+    return 0;
+}
+
+static void* reader(void* arg) {
+    BenchThread* self = arg;
+    unsigned seed = self->id * 7919 + 1;
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        int64_t id = rand_r(&seed) % BENCH_ROWS;
+        Row row;
+        double start = now_seconds();
+        int found = table_get_row(self->table, id, &row) == 0;
+        double wait = now_seconds() - start;
+        if (wait > self->max_wait) {
+            self->max_wait = wait;
+        }
+        if (!found || !row_matches(&row, id)) {
+            self->errors++;
+        }
+        if (++self->ops % BENCH_SCAN_EVERY == 0) {
+            int64_t lo = rand_r(&seed) % (BENCH_ROWS - BENCH_SCAN_ROWS);
+            long count = 0;
+            table_scan_range(self->table, lo, lo + BENCH_SCAN_ROWS - 1, count_row, &count);
+            self->errors += count != BENCH_SCAN_ROWS;
+        }
+    }
+    return NULL;
+}
+
+static void* writer(void* arg) {
+    BenchThread* self = arg;
+    int64_t next = 0, oldest = 0; // The writer's k-th row has id BENCH_ROWS + k * writers + id
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        Row row;
+        fill_row(&row, BENCH_ROWS + next * self->writers + self->id);
+        self->errors += table_insert(self->table, &row) != 0;
+        next++;
+        self->ops++;
+        if (next - oldest > BENCH_WRITER_LIVE) {
+            self->errors += table_delete_id(self->table, BENCH_ROWS + oldest * self->writers + self->id) != 0;
+            oldest++;
+            self->ops++;
+        }
+    }
+    return NULL;
+}
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void)st; (void)flag; (void)ftw;
+    return remove(path);
+}
+
+int main(int argc, char** argv) {
+    int readers = argc > 1 ? atoi(argv[1]) : 4;
+    int writers = argc > 2 ? atoi(argv[2]) : 4;
+    double seconds = argc > 3 ? atof(argv[3]) : 2;
+    WalConfig wal_config = wal_default_config();
+    wal_config.commit_delay_us = argc > 4 ? (uint32_t)atoi(argv[4]) : 0;
+    if (readers < 0 || writers < 0 || readers + writers > BENCH_MAX_THREADS || seconds <= 0) {
+        printf("Usage: %s [readers] [writers] [seconds] [commit-delay-us], at most %d threads\n", argv[0], BENCH_MAX_THREADS);
+        return 1;
+    }
+
+    // Runs in a data directory of its own, removed at the end
+    char dir[] = "/tmp/byod_bench_XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0 || mkdir(TABLE_DATA_DIR, 0755) != 0) {
+        printf("Error: Failed to set up a data directory\n");
+        return 1;
+    }
+    PagerConfig config = pager_default_config();
+    config.cache_pages = BENCH_CACHE_PAGES;
+    Table* table = create_table(&config, &wal_config);
+    Row* rows = malloc(BENCH_ROWS * sizeof(Row));
+    if (table == NULL || rows == NULL) {
+        printf("Error: Failed to create the table\n");
+        return 1;
+    }
+    for (int64_t id = 0; id < BENCH_ROWS; id++) {
+        fill_row(&rows[id], id);
+    }
+    int loaded = table_insert_batch(table, rows, BENCH_ROWS);
+    free(rows);
+    if (loaded != 0) {
+        printf("Error: Failed to load the table\n");
+        return 1;
+    }
+
+    WalStats before, after;
+    wal_get_stats(table->wal, &before);
+    pthread_t threads[BENCH_MAX_THREADS];
+    BenchThread state[BENCH_MAX_THREADS];
+    for (int i = 0; i < readers + writers; i++) {
+        state[i] = (BenchThread){ .table = table, .id = i < readers ? i : i - readers, .writers = writers };
+        pthread_create(&threads[i], NULL, i < readers ? reader : writer, &state[i]);
+    }
+    double start = now_seconds();
+    struct timespec run = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+    nanosleep(&run, NULL);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    long reads = 0, changes = 0, errors = 0;
+    double max_wait = 0;
+    for (int i = 0; i < readers + writers; i++) {
+        pthread_join(threads[i], NULL);
+        if (i < readers) {
+            reads += state[i].ops;
+            max_wait = state[i].max_wait > max_wait ? state[i].max_wait : max_wait;
+        } else {
+            changes += state[i].ops;
+        }
+        errors += state[i].errors;
+    }
+    double elapsed = now_seconds() - start;
+    wal_get_stats(table->wal, &after);
+    uint64_t syncs = after.syncs - before.syncs;
+
+    printf("%d readers, %d writers, %.1f s, commit delay %" PRIu32 " us\n", readers, writers, elapsed, wal_config.commit_delay_us);
+    printf("  changes: %10.0f /s, %.2f commits per sync\n", changes / elapsed,
+           syncs > 0 ? (double)(after.commits - before.commits) / syncs : 0.0);
+    printf("  lookups: %10.0f /s, slowest %.3f ms\n", reads / elapsed, max_wait * 1e3);
+    free_table(table);
+    if (chdir("/") == 0) {
+        nftw(dir, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+    }
+    if (errors > 0) {
+        printf("Error: %ld operations failed or read a wrong row\n", errors);
+        return 1;
+    }
+    return 0;
+}
@@ -6,27 +6,92 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <math.h>
+#include <pthread.h>
 
-// This B-Tree implementation is a simplified version that does Linear Search(not Binary), stores the B-Tree in Ram, not disk and is meant for educational purposes.
+// This B-Tree implementation is a simplified version meant for educational purposes.
+// Keys and RowLocs are stored inline in contiguous arrays of the node, so a node is searched with the branchless/SIMD
+// kernels of keysearch.h over one array, without pointer chasing.
+// The tree lives on disk: every node is a page of its own index file, managed by a Pager exactly like the table's pages,
+// so the index survives restarts. Page 0 of the index file holds an IndexMeta header, nodes use the pages after it.
+// The index pager keeps a rollback journal, so after a crash the file is back at its last index_checkpoint (or open),
+// a consistent tree that the owner brings up to date by replaying its own log.
+// Lookups (index_find, index_range) may run in any number of threads alongside one thread making changes;
+// see the latching notes in btree.c.
 // This API uses the same function names as AVL tree API, to be used as a drop-in replacement
 #include "page.h" // For RowLoc
-#define N 4 // Degree of the B-Tree, i.e., maximum number of children per node
+#include "pager.h"
+#ifndef BTREE_ORDER
+#define BTREE_ORDER 202 // Default fan-out: the largest even order whose node fits in a 4 KB page
+#endif
+#define N BTREE_ORDER // Degree of the B-Tree, i.e., maximum number of children per node; select with make BTREE_ORDER=<even number>
 #define MIN (N/2) // Minimum number of keys in a non-root node
+#define BTREE_NIL -1 // Page id meaning "no node"
+#define BTREE_MAGIC 0x45525442 // "BTRE", marks an initialised index file
+#define BTREE_MERGE_REBUILD 4 // index_merge rebuilds the tree when adding at least 1/BTREE_MERGE_REBUILD of its size
+#define BTREE_MAX_DEPTH 32 // Deepest path a cursor can hold; a tree of order 4 needs over 2^31 keys to reach it
 
-struct Item;           // Forward declaration
-typedef struct Item Item; // Typedef alias
+typedef struct Item { // A key with its row position, as passed in and out of the tree
+    int64_t key;
+    RowLoc pos;
+} Item;
 
-typedef struct IndexNode {
-    Item* values[N+1];
-    struct IndexNode* child[N+2];
-    int filled;
-    int children;
+typedef struct IndexNode { // Layout of a node page
+    int32_t filled;
+    int32_t children;
+    int64_t keys[N+1];  // Sorted keys, one spare slot for shifting
+    RowLoc locs[N+1];   // locs[i] is the row position of keys[i]
+    int32_t child[N+2]; // Page ids of the children; child[0] links the free list when the page is unused
 } IndexNode;
 
-// can make the index and insert return, but not needed for now
-void index_insert(IndexNode** root, int64_t key, RowLoc pos); // Inserts a new node with key and position into the AVL tree
-int index_find(IndexNode** root, int64_t key, RowLoc* pos); // Finds the node with the given key and updates pos with its position, returns 0 if found, 1 if not found
-void index_delete(IndexNode** root, int64_t key); // Deletes the node with the given key from the AVL tree
-void free_index(IndexNode** root); // Frees the AVL tree
+typedef struct { // Layout of page 0 of the index file
+    uint32_t magic;
+    uint32_t order;    // BTREE_ORDER the file was built with; another order forces a rebuild
+    uint32_t clean;    // 1 if the tree was checkpointed or closed by its owner, 0 while it is being rebuilt
+    int32_t root;      // Page id of the root node, BTREE_NIL when the tree is empty
+    int32_t num_pages; // Pages in use by the index file, including this one
+    int32_t free_head; // First freed node page, BTREE_NIL if none
+    uint64_t checkpoint_lsn; // Owner's log position the tree was last checkpointed at, see index_checkpoint
+} IndexMeta;
 
-#endif //BTREE_H
\ No newline at end of file
+_Static_assert(N >= 4 && N % 2 == 0, "BTREE_ORDER must be an even number of at least 4");
+_Static_assert(sizeof(IndexNode) <= PAGE_SIZE, "IndexNode must fit in a page, lower BTREE_ORDER");
+
+typedef struct {
+    Pager* pager;      // Pager over the index file
+    IndexMeta meta;    // In-memory copy of page 0, written back whenever it changes
+    bool needs_rebuild; // Set by open_index when the file was new or unusable, and by index_clear; the tree is then empty and the owner must re-insert every key
+    bool deleted;      // Set by index_delete_files, so free_index does not write the file back
+    pthread_rwlock_t latch; // Shared by lookups, exclusive while the root moves or the tree is rebuilt
+} BTree;
+
+// Ordered iteration. Keys live in internal nodes too, so leaf sibling links (as in a B+tree) would skip them;
+// instead a cursor keeps the root-to-node path of page ids, and next/prev move along it in amortised O(1).
+// For each node on the path, slot is the child descended into; for the last one, it is the key the cursor is on.
+// Any insert or delete invalidates open cursors of the tree, and cursors take no latches: they are for a thread
+// that has the tree to itself. index_range reads ordered batches alongside a writer.
+typedef struct {
+    BTree* tree;
+    int depth;                      // Nodes on the path, 0 when the cursor is not on a key
+    int32_t node[BTREE_MAX_DEPTH];  // Page ids from the root down
+    int32_t slot[BTREE_MAX_DEPTH];
+} IndexCursor;
+
+BTree* open_index(const char* data_dir, const PagerConfig* config); // Opens or creates the index stored in data_dir
+int index_insert(BTree* tree, int64_t key, RowLoc pos); // Inserts a new node with key and position into the B-Tree, returns 0 on success, 1 if a node could not be had (the key is then missing)
+int index_find(BTree* tree, int64_t key, RowLoc* pos); // Finds the node with the given key and updates pos with its position, returns 0 if found, 1 if not found
+size_t index_range(BTree* tree, int64_t from, int64_t to, Item* out, size_t max); // Copies up to max items with from <= key <= to into out in key order, all as of one moment; returns how many. Continue from the last key + 1
+int index_bulk_load(BTree* tree, Item* items, size_t n); // Builds an empty B-Tree from n pairs in any order, much faster than n inserts; reorders items. Returns 0 on success, 1 on failure (the tree is then empty)
+int index_seek(IndexCursor* cursor, BTree* tree, int64_t key); // Places the cursor on the first key >= key, returns 0 if there is one, 1 if not
+int index_seek_first(IndexCursor* cursor, BTree* tree); // Places the cursor on the smallest key, returns 0 on success, 1 if the tree is empty
+int index_seek_last(IndexCursor* cursor, BTree* tree); // Places the cursor on the largest key, returns 0 on success, 1 if the tree is empty
+int index_next(IndexCursor* cursor); // Moves to the next larger key, returns 0 on success, 1 past the end (the cursor is then off the tree)
+int index_prev(IndexCursor* cursor); // Moves to the next smaller key, returns 0 on success, 1 before the start
+int index_cursor_item(const IndexCursor* cursor, Item* item); // Copies the key and row position under the cursor, returns 0 on success, 1 if off the tree
+int index_merge(BTree* tree, Item* items, size_t n, size_t existing); // Adds n pairs whose keys are not in the tree yet; existing is the number of keys already in it. Reorders items. Returns 0 on success, 1 on failure, after which the tree may lack any key and must be dropped
+int index_delete(BTree* tree, int64_t key); // Deletes the node with the given key from the B-Tree, returns 0 on success, 1 if a node could not be pinned (the key may then remain)
+int index_checkpoint(BTree* tree, uint64_t lsn); // Writes the tree to disk as the state a crash rolls back to, recording the owner's log position lsn. Returns 0 on success
+void index_clear(BTree* tree); // Drops every key and sets needs_rebuild, for an owner that cannot bring the tree up to date from its log
+int index_delete_files(BTree* tree); // Deletes the index files, returns how many were deleted
+void free_index(BTree* tree); // Writes the B-Tree back, marks it clean and frees it; its checkpoint_lsn is kept
+
+#endif //BTREE_H
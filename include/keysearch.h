@@ -0,0 +1,28 @@
+#ifndef KEYSEARCH_H
+#define KEYSEARCH_H
+
+#include <stdint.h>
+
+// Key search inside a B-Tree node: finds the first slot whose key is >= the search key in a sorted int64_t array.
+// Large nodes are first narrowed with a branchless binary search down to KEYSEARCH_WINDOW keys, which are then
+// compared all at once by the widest vector kernel the CPU supports (picked at runtime), so there are no
+// data-dependent branches to mispredict.
+
+#define KEYSEARCH_WINDOW 16 // Keys left for the vector kernel after binary narrowing
+
+typedef enum {
+    KEYSEARCH_SCALAR,     // Linear while loop, the reference
+    KEYSEARCH_BRANCHLESS, // Branchless binary search all the way down
+    KEYSEARCH_SSE42,      // Narrowing, then 2 keys per compare
+    KEYSEARCH_AVX2,       // Narrowing, then 4 keys per compare
+    KEYSEARCH_AVX512,     // Narrowing, then 8 keys per compare
+    KEYSEARCH_KERNELS     // Number of kernels
+} KeySearchKernel;
+
+int keysearch(const int64_t* keys, int n, int64_t key); // Index of the first key >= key (n if none), using the selected kernel
+int keysearch_with(KeySearchKernel kernel, const int64_t* keys, int n, int64_t key); // Same with a given kernel, for benchmarks
+KeySearchKernel keysearch_kernel(void); // Kernel selected for this CPU
+int keysearch_supported(KeySearchKernel kernel); // 1 if the CPU can run the kernel
+const char* keysearch_kernel_name(KeySearchKernel kernel);
+
+#endif //KEYSEARCH_H
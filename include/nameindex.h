@@ -0,0 +1,34 @@
+#ifndef NAMEINDEX_H
+#define NAMEINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "page.h" // For RowLoc and MAX_NAME_SIZE
+
+// Secondary index on Row.name: a chained hash table from name to the positions of the rows carrying it.
+// Names are not unique, so a name may have many entries, one per row. The index only lives in memory;
+// the table builds it from its pages the first time a name is looked up.
+
+#define NAME_INDEX_MIN_BUCKETS 64 // Initial bucket count, doubled whenever entries outnumber buckets
+
+typedef struct NameEntry {
+    uint64_t hash;               // Full hash of name, compared before the string
+    char name[MAX_NAME_SIZE];
+    RowLoc pos;
+    struct NameEntry* next;      // Next entry in the same bucket
+} NameEntry;
+
+typedef struct {
+    NameEntry** buckets;
+    size_t num_buckets;          // Always a power of two
+    size_t count;                // Entries in the index
+} NameIndex;
+
+NameIndex* create_name_index(void);
+void free_name_index(NameIndex* index);
+int name_index_insert(NameIndex* index, const char* name, RowLoc pos); // Adds a row, returns 0 on success, 1 on allocation failure
+int name_index_delete(NameIndex* index, const char* name, RowLoc pos); // Removes the row at pos, returns 0 on success, 1 if not indexed
+int name_index_find(const NameIndex* index, const char* name, RowLoc* pos); // Sets pos to the first row (in page order) with the name, returns 0 if found, 1 if not
+
+#endif //NAMEINDEX_H
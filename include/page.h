@@ -16,10 +16,21 @@ typedef struct {
     char email[MAX_EMAIL_SIZE];
 } Row;
 
+#define PAGE_NO_NEXT -1 // End of the free-page list
+#define PAGE_SLOT_WORDS ((NUM_ROWS_PAGE + 63) / 64) // 64-bit words in the slot bitmap
+// Header.layout tells the on-disk page formats apart. The first builds' pages have no layout byte: they start with
+// a byte per slot (0 or 1) and keep their rows at byte 40, see page_upgrade.
+#define PAGE_LAYOUT_BITMAP 2 // Header.layout of pages with the slot bitmap but no LSN; never a valid first byte of the byte-per-slot layout
+#define PAGE_LAYOUT_LSN 3    // Header.layout of current pages
+
 typedef struct {
-    uint8_t row_exists[NUM_ROWS_PAGE];
-    size_t num_rows;
-    int page_id;
+    uint8_t layout;       // PAGE_LAYOUT_LSN; older pages are converted by page_upgrade
+    uint8_t in_free_list; // 1 while the page has a free slot and is linked into the free-page list
+    int32_t page_id;
+    int32_t next_free;    // Next page of the table's free-page list, PAGE_NO_NEXT at its end
+    uint32_t num_rows;
+    uint64_t lsn;         // Log sequence number of the last logged change applied to the page, see wal.h
+    uint64_t slot_bits[PAGE_SLOT_WORDS]; // Bit i of word i / 64 is set while slot i holds a row
 } Header;
 
 typedef struct {
@@ -27,16 +38,25 @@ typedef struct {
     Row rows[NUM_ROWS_PAGE];
 } Page;
 
+_Static_assert(sizeof(Page) <= PAGE_SIZE, "Page must fit in PAGE_SIZE");
+
 typedef struct { // Pair to store a row's position
     int32_t page_slot; // Index of page in table
     int32_t row_slot;  // Index of row in page
 } RowLoc;
 
-Page* create_page();
+static inline bool page_row_exists(const Page* page, size_t slot) { // True if the slot holds a row
+    return slot < NUM_ROWS_PAGE && ((page->header.slot_bits[slot / 64] >> (slot % 64)) & 1);
+}
+
+Page* create_page(); // Zeroed PAGE_SIZE bytes at a PAGE_SIZE-aligned address, released with free_page (or free)
 void free_page(Page* page);
+bool page_upgrade(Page* page); // Converts a page with an older header in place (an all-zero page becomes empty), returns true if it did
+int page_next_row(const Page* page, size_t slot); // Returns the first occupied slot >= slot, -1 if none; iterate with for(s = page_next_row(p, 0); s >= 0; s = page_next_row(p, s + 1))
 int page_find_row_id(Page* page, int64_t id); // returns -1 on failure, else returns the slot index in page
 int page_find_row_name(Page* page, const char* name); // returns -1 on failure, else returns the slot index in page
-int page_insert_row(Page* page, const Row* row); // returns 0 on success, 1 on failure
+int page_insert_row(Page* page, const Row* row); // returns -1 on failure, else returns the slot index the row was stored in
+int page_put_row(Page* page, size_t slot_index, const Row* row); // Stores row in the given slot, whether it was free or not; returns 0 on success, 1 on a bad slot
 int page_delete_row(Page* page, size_t slot_index); // returns 0 on success, 1 on failure. Deletes row with given slot_index(not row id)
 
 #endif //PAGE_H
\ No newline at end of file
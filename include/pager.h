@@ -1,24 +1,218 @@
 #ifndef PAGER_H
 #define PAGER_H
 
-#define CACHE_SIZE 10 // Maximum number of pages in the cache
+#include <stdint.h>
+#include <pthread.h>
+
 #include "page.h"
+#include "uring.h"
+
+#define CACHE_SIZE 10 // Default maximum number of pages in the cache
+#define CACHE_MIN_PAGES 4 // Smallest cache the pager accepts, whatever the configured budget
+// Largest cache the pager accepts: no table has more pages, and twice it still fits a size_t, as sizing the hash tables needs
+#define CACHE_MAX_PAGES (SIZE_MAX / 4 < INT32_MAX ? SIZE_MAX / 4 : (size_t)INT32_MAX)
+#define CACHE_SPARE_FRAMES 8 // Page frames allocated beyond the capacity: a miss reads into one before evicting, and pinned pages can hold the cache over capacity
+#define PAGER_HUGEPAGE_SIZE ((size_t)2 << 20) // Explicit huge pages are mapped in multiples of this (2 MB on x86-64)
+
+// Bytes the cache spends per cached page: the page itself, its list node and its share of the hash table
+#define CACHE_BYTES_PER_PAGE (PAGE_SIZE + 4 * sizeof(void*) + sizeof(pthread_rwlock_t) + 2 * sizeof(void*))
+
+#define PAGER_DATA_FILE "pages.db" // Name of the single data file inside data_dir
+#define PAGER_PREALLOC_PAGES 256 // The data file reserves disk space in extents of this many pages (1 MB)
+#define PAGER_MMAP_MIN_PAGES 256 // Smallest mapping of the data file in PAGER_MODE_MMAP
+#define PAGER_MMAP_RESERVE_PAGES ((size_t)1 << 24) // Address space reserved for the mapping (64 GB), so it grows without moving
+#define PAGER_LATCH_CHUNK 1024 // Page latches allocated at once in PAGER_MODE_MMAP
+#define PAGER_FLUSH_CLEAN 3 // Default number of least recently used pages the flusher keeps clean
+#define PAGER_READAHEAD_PAGES 256 // Default read-ahead window (1 MB), beyond the kernel's own read-ahead of a file
+#define PAGER_FLUSH_BATCH 16 // Pages the flusher writes per io_uring submission
+#define PAGER_READAHEAD_TRIGGER 2 // Reads of consecutive pages after which a run counts as sequential
+#define PAGER_JOURNAL_FILE "journal" // Rollback journal inside data_dir, see PagerConfig.journal
+#define PAGER_JOURNAL_MAGIC 0x4C4E524A // "JRNL", marks a journal with saved pages
+
+typedef enum {
+    PAGER_STORAGE_SINGLE_FILE, // All pages in data_dir/pages.db, page_id at offset page_id * PAGE_SIZE (default)
+    PAGER_STORAGE_PAGE_FILES   // Legacy layout, one data_dir/page_<id>.bin file per page
+} PagerStorage;
+
+typedef enum {
+    PAGER_MODE_COPY, // Pages are copied into cached buffers and written back on eviction (default)
+    PAGER_MODE_MMAP  // Pages are pointers into a shared mapping of the single data file, no cache of our own
+} PagerMode;
+
+typedef enum { // Which cached page makes room for a new one
+    PAGER_POLICY_LRU, // The least recently used (default)
+    PAGER_POLICY_2Q   // Scan resistant: pages used once are evicted before pages used again (Johnson & Shasha's 2Q)
+} PagerPolicy;
+
+typedef enum { // How pager_pin latches the page
+    PAGER_LATCH_NONE,     // Pinned only; for the writer reading pages no other thread changes
+    PAGER_LATCH_SHARED,   // Any number of readers at once
+    PAGER_LATCH_EXCLUSIVE // The writer changing the page; waits for its readers to leave
+} PagerLatch;
+
+typedef enum { // Access pattern hints, see pager_advise
+    PAGER_ACCESS_NORMAL,
+    PAGER_ACCESS_SEQUENTIAL,
+    PAGER_ACCESS_RANDOM
+} PagerAccess;
 
 struct LRUCache;           // Forward declaration
 typedef struct LRUCache LRUCache; // Typedef alias
 // LRUCache is meant to be used by pager internally, so no need to access it directly from outside
 
+typedef struct {
+    size_t cache_pages; // Capacity of the cache in pages; 0 means derive it from cache_bytes
+    size_t cache_bytes; // Memory budget for the cache, only used when cache_pages is 0
+    PagerStorage storage; // On-disk layout of the pages
+    PagerMode mode; // PAGER_MODE_MMAP implies PAGER_STORAGE_SINGLE_FILE
+    size_t flush_clean_pages; // Least recently used pages a background thread keeps written back, so evictions need no write; 0 turns it off
+    bool journal; // Save a page's contents as of the last pager_sync before overwriting it, so a crash rolls the file back to that sync.
+                  // For files whose pages must change together (e.g. B-Tree nodes); implies PAGER_MODE_COPY and no flusher
+    PagerPolicy policy; // Replacement policy of the cache
+    size_t readahead_pages; // Once reads run through consecutive pages, a background thread has the kernel fetch this many
+                            // pages ahead of them, so a scan waits for the disk once per window rather than once per page; 0 turns it off
+    bool io_uring; // Read and write the single data file through io_uring, submitting the writes that go together (a sync, a
+                   // flusher round, a miss and the write-back of its victim) with one system call; pread / pwrite where it is unavailable
+    bool direct_io; // Open the single data file with O_DIRECT, so a page is cached once, in the pool, instead of also in the kernel's
+                    // page cache; size the pool to the working set. PAGER_MODE_COPY only and without read-ahead, see "Direct I/O" below
+    bool hugepages; // Map the cache's page frames with huge pages (reserved ones, else transparent ones), so a large pool
+                    // costs few TLB entries; 4 KB pages where neither is available
+} PagerConfig;
+
+// Direct I/O: O_DIRECT transfers need buffers, offsets and lengths aligned to the device's logical block size (512 or
+// 4096 bytes). With PagerConfig.direct_io every transfer on the data file is whole pages at a page_id * PAGE_SIZE offset,
+// from or into PAGE_SIZE-aligned memory: cached pages come from create_page, the flusher and the journal use aligned
+// buffers of their own, and pager_write_pages copies data that is not PAGE_SIZE-aligned through an aligned buffer first
+// (so callers writing large batches should allocate them aligned). File systems that refuse O_DIRECT (e.g. tmpfs) get
+// buffered I/O instead, reported by PagerStats.direct_io.
+
+typedef struct {
+    size_t capacity_pages; // Maximum number of cached pages
+    size_t cached_pages;   // Pages currently held
+    size_t bytes_in_use;   // Bytes currently held by the cache
+    size_t peak_bytes;     // High-water mark of bytes_in_use
+    size_t pages_written;  // Dirty pages written back on eviction or shutdown
+    size_t writes_avoided; // Clean pages dropped without being rewritten
+    size_t mapped_bytes;   // Size of the data file mapping in PAGER_MODE_MMAP
+    size_t eviction_writes; // Evictions that had to write a dirty page before reading the next one
+    size_t flush_queue_depth; // Dirty pages currently waiting for the flusher
+    size_t pages_flushed;  // Pages written by the flusher
+    double flush_avg_us;   // Mean flusher write time per page
+    double flush_max_us;   // Slowest flusher round (one page, or one io_uring batch)
+    size_t checkpoint_pending; // Pages the running checkpoint still has to write
+    const char* policy;    // Name of the replacement policy
+    size_t cache_hits;     // Page requests served from the cache
+    size_t cache_misses;   // Page requests that had to read the page
+    size_t ghost_hits;     // Misses on pages evicted lately that the policy still remembered (2Q)
+    size_t readahead_windows; // Read-ahead requests handed to the kernel
+    size_t readahead_pages;   // Pages they covered
+    size_t ring_ops;          // Page reads, writes and syncs done through io_uring
+    size_t ring_submits;      // System calls they took
+    bool direct_io;           // The data file is read and written with O_DIRECT
+    size_t frame_slots;       // Page frames reserved up front for the cache; 0 in PAGER_MODE_MMAP
+    size_t frames_used;       // Of them, frames that have held a page so far
+    const char* frame_backing; // Memory pages they are mapped with, NULL without frames
+    size_t heap_nodes;        // Pages cached in memory of their own because every frame was taken
+} PagerStats;
+
+// The pager caches PAGE_SIZE blocks by page id and never looks inside them, so besides table Pages
+// it also serves other page formats (e.g. B-Tree nodes) that callers cast the returned Page* to.
+//
+// Threads may share a pager through pager_pin / pager_unpin. A pinned page stays in the cache (eviction and
+// the flusher pass it over) and its pointer stays valid until unpinned, and the pin also takes the page's
+// reader/writer latch, so readers of a page run in parallel while a writer has it to itself. Pages may only be
+// changed while pinned, and by one writer thread at a time: that thread alone calls pager_sync, pager_truncate,
+// pager_write_pages and the checkpoint functions, and does so holding no exclusive latches.
+// pager_get predates pinning and is for single-threaded callers only.
 typedef struct {
     LRUCache* cache;
     const char* data_dir; // Directory where the pages are stored
+    PagerStorage storage;
+    int fd; // Data file descriptor for PAGER_STORAGE_SINGLE_FILE, -1 otherwise
+    bool direct; // fd was opened with O_DIRECT, see PagerConfig.direct_io
+    size_t file_pages; // Pages currently covered by the data file
+    size_t reserved_pages; // Pages the data file has disk space reserved for
+    PagerMode mode;
+    char* map; // Mapping of the data file in PAGER_MODE_MMAP, NULL otherwise
+    size_t map_pages; // Pages covered by map, may run past the end of the file
+    size_t map_reserved_pages; // Address space reserved at map, which it grows into without moving; 0 if none could be reserved
+    int advice; // Current madvise hint, reapplied when the file is remapped
+    // Background flusher, see PagerConfig.flush_clean_pages
+    pthread_mutex_t lock; // Guards the cache and file bookkeeping; held by every pager call and by the flusher, but never while waiting for a page latch
+    pthread_cond_t flush_wake; // Signalled when a page becomes dirty, and at shutdown
+    pthread_cond_t flush_done; // Broadcast when the flusher finishes a write
+    pthread_t flusher;
+    bool flusher_running;
+    bool flusher_stop;
+    size_t flush_clean_pages;
+    int flushing[PAGER_FLUSH_BATCH]; // Pages the flusher is writing; they must not be read or written meanwhile
+    size_t flushing_count;
+    uint64_t dirty_seq; // Counter stamped on a page each time it becomes dirty
+    pthread_rwlockattr_t latch_attr; // For page latches
+    pthread_rwlock_t** latch_chunks; // Page latches of PAGER_MODE_MMAP, PAGER_LATCH_CHUNK per entry, allocated on first use
+    size_t latch_chunk_count;
+    // Rollback journal, see PagerConfig.journal
+    bool journal;
+    int journal_fd;
+    size_t journal_base_pages; // Pages in the data file at the last sync; only they have contents worth saving
+    size_t journal_entries;    // Pages saved since the last sync
+    uint8_t* journaled;        // Bitmap of the pages already saved since the last sync
+    size_t journaled_pages;    // Pages the bitmap covers
+    // Checkpoint, see pager_checkpoint_begin
+    int* checkpoint_pages;     // Pages that were dirty when the checkpoint began, least recently used first
+    size_t checkpoint_count;
+    size_t checkpoint_next;    // Next entry of checkpoint_pages the flusher looks at
+    size_t checkpoint_pending; // Pages of checkpoint_pages not written yet
+    bool checkpoint_failed;    // A checkpoint page could not be written
+    // Read-ahead, see PagerConfig.readahead_pages
+    size_t readahead_pages;
+    int last_read_page;        // Last page read from the file, -1 if none
+    size_t sequential_reads;   // Reads of consecutive pages that ended at last_read_page
+    bool sequential_hint;      // pager_advise announced a sequential scan, so its first read starts a run
+    size_t readahead_end;      // The current run has been prefetched up to here
+    size_t prefetch_first;     // Window waiting for the prefetcher
+    size_t prefetch_count;     // 0 if none
+    pthread_cond_t prefetch_wake;
+    pthread_t prefetcher;
+    bool prefetcher_running;
+    bool prefetcher_stop;
+    size_t readahead_windows;
+    size_t readahead_issued;   // Pages covered by readahead_windows
+    // io_uring, see PagerConfig.io_uring
+    IoRing* ring;              // Used under lock; NULL when the file is read and written with pread / pwrite
+    bool use_ring;             // The flusher gets a ring of its own
+    size_t ring_ops;
+    size_t ring_submits;
 } Pager;
 
-int save_page(Page* page, const char* data_dir);
+// Per-page file layout (PAGER_STORAGE_PAGE_FILES)
+int save_page(int page_id, Page* page, const char* data_dir);
 Page* load_page(int page_id, const char* data_dir);
+// One-shot conversion of data_dir/page_<id>.bin files into data_dir/pages.db, removing the old files once done.
+// Returns the number of pages converted, 0 if there was nothing to convert, -1 on failure.
+// create_pager runs it automatically for PAGER_STORAGE_SINGLE_FILE.
+int pager_convert_page_files(const char* data_dir);
+
+PagerConfig pager_default_config(void); // CACHE_SIZE pages
+size_t pager_config_capacity(const PagerConfig* config); // Number of pages the config allows, between CACHE_MIN_PAGES and CACHE_MAX_PAGES
 
-Pager* create_pager(const char* data_dir);
+Pager* create_pager(const char* data_dir, const PagerConfig* config); // NULL config uses pager_default_config()
 void free_pager(Pager* pager);
-Page* pager_get(Pager *pager, int page_id);
+Page* pager_get(Pager *pager, int page_id); // The page stays valid only until the next pager_get; single-threaded use only
+Page* pager_pin(Pager* pager, int page_id, PagerLatch latch); // Returns the page pinned in memory with the latch held, NULL on failure; every pin needs a pager_unpin
+void pager_unpin(Pager* pager, int page_id, PagerLatch latch, bool dirty); // Releases the latch taken by pager_pin and the pin; dirty marks the page modified
+void pager_advise(Pager* pager, PagerAccess access); // Hints the kernel about upcoming accesses, e.g. sequential before a full scan
+void pager_get_stats(Pager* pager, PagerStats* stats); // Fills stats with the current memory accounting
+Page* pager_load_page(Pager* pager, int page_id); // Reads a page from disk bypassing the cache, caller frees it. NULL if it does not exist
+int pager_delete_files(Pager* pager, size_t num_pages); // Deletes the on-disk pages and discards cached changes, returns files deleted
+int pager_sync(Pager* pager); // Writes every dirty page and fsyncs, so the file matches the cache; with a journal, this is the state a crash rolls back to. Returns 0 on success
+int pager_truncate(Pager* pager, size_t num_pages); // Drops every page from num_pages on, cached or not, without writing them. Returns 0 on success
+// Fuzzy checkpoint: the pages dirty now are written in the background by the flusher (at once without one) while the
+// pager stays in use; poll until it reports them all on disk. Pages dirtied later are not waited for.
+void pager_checkpoint_begin(Pager* pager);
+int pager_checkpoint_poll(Pager* pager); // 0 once every page of the checkpoint is written and synced, 1 while some are not, -1 if one could not be written
+void pager_mark_dirty(Pager* pager, int page_id); // Must be called after modifying a page returned by pager_get, or the change is lost on eviction
+int pager_write_pages(Pager* pager, int first_page_id, const void* data, size_t count); // Writes count consecutive PAGE_SIZE pages from data with one large write, bypassing the cache; cached copies are updated. Returns 0 on success
 // int pager_flush(Pager *pager, Page *page); // we never actually explicitly delete a page, so this is not needed; This is used internally before removing from LRU
 
 
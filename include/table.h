@@ -4,34 +4,88 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 #include "page.h"
 #include "btree.h"
 #include "pager.h"
+#include "nameindex.h"
+#include "wal.h"
 
-#define TABLE_MAX_PAGES 100
+#define TABLE_DATA_DIR "data"
+#define TABLE_META_FILE "table.meta" // Table header, in TABLE_DATA_DIR
+#define TABLE_MAGIC 0x4C425454 // "TTBL", marks a table header
+#define TABLE_BATCH_CHUNK_PAGES 64 // Pages table_insert_batch fills in memory before writing them with one call
+#define TABLE_SCAN_BATCH 64 // Index entries table_scan_range reads at a time
+#define TABLE_INDEX_CACHE_SHARE 8 // The index pager gets 1/TABLE_INDEX_CACHE_SHARE of the cache budget, the table pager the rest
+
+typedef struct { // Layout of the table header file
+    uint32_t magic;
+    uint32_t clean;      // 1 if the table was closed cleanly, so no log records follow the checkpoint
+    uint64_t num_pages;  // The fields below describe the table as of checkpoint_lsn
+    uint64_t num_rows;
+    int32_t free_head;   // Table.free_head
+    int32_t index_root;  // Root node of the primary index at close; an index with another root belongs to another state of the table
+    uint64_t checkpoint_lsn; // Log position of the last completed checkpoint: every change up to it is in the pages on disk
+} TableMeta;
 
 typedef struct {
-    size_t num_pages;
+    size_t num_pages; // Read atomically by lookups, as the writer grows it
     size_t num_rows;
-    IndexNode* root; // Root of the AVL tree for indexing
+    int free_head; // First page with a free slot, PAGE_NO_NEXT if every page is full; the rest are linked through their headers
+    BTree* index; // Primary-key index, persisted in data/index; NULL once dropped, read by lookups with table_index
+    BTree* dropped_index; // Index given up on while the table is open, freed with the table as lookups may still be in it
+    NameIndex* names; // Secondary index on Row.name, built in memory on the first name lookup; NULL until then
     Pager* pager; // Pager for managing pages
+    Wal* wal; // Redo log of row changes, in data/wal.log
+    int meta_fd; // Open table header file, -1 once the files are deleted
+    uint64_t checkpoint_lsn; // Of the last completed checkpoint, as in the header
+    bool checkpointing; // A fuzzy checkpoint is waiting for its pages to be written
+    TableMeta checkpoint_meta; // Header to write once the running checkpoint's pages are on disk
+    pthread_mutex_t write_lock; // Held by every change, so there is one writer at a time; recursive
+    pthread_rwlock_t names_lock; // Guards the name index
 } Table;
 
+typedef int (*TableScanCallback)(const Row* row, RowLoc pos, void* arg); // Called per row by table_scan_range; return non-zero to stop the scan
+
 // Note that this API provides no direct access to page insertion, deletion
 // As pages are just internal implementation to deal with Rows 
 // The delete and find operations are done with fast indexing by default, if no indexing is found, it will do a linear search
+// The index is kept on disk; if it is missing or was not closed cleanly, create_table rebuilds it from the table pages
+// Every row change is logged to the write-ahead log and committed before the call returns, so it survives a crash.
+// Once the log grows or ages past its checkpoint limits, a fuzzy checkpoint has the pager write the pages dirty at
+// that point in the background; when they are on disk the table header records the counts as of the checkpoint
+// and the log is truncated to it. create_table then only replays the log written since the last checkpoint, so
+// opening takes about the same time however large the table is. Only data from older builds, or a lost log or
+// index, makes it scan every page instead. Batches are not logged; each ends with a checkpoint of its own.
+// Name lookups go through the secondary name index, so rows must be changed through this API (e.g. table_update_row) to keep it current
+//
+// A table may be shared by threads. Changes take write_lock and run one at a time; lookups (find, get_row,
+// scan_range, print) take no table lock and run alongside them and each other, pinning the pages they read
+// under a shared page latch while the writer holds the page it changes exclusively, and walking the index
+// with latch coupling. A change is logged under write_lock and both it and the page latch are released before
+// the writer waits for the log sync, so writers share syncs and lookups never wait on one. A lookup sees each
+// change either entirely or not at all, possibly before it is durable; the change's function only returns
+// once it is. Positions returned by the find functions may be stale by the time another thread
+// uses them, so readers copy rows with table_get_row, or pin the page with table_pin_page and check the row
+// is still there.
 
-Table* create_table();
+Table* create_table(const PagerConfig* config, const WalConfig* wal_config); // NULL configs use the defaults
 void free_table(Table* table);
 int table_find_id(Table* table, int64_t id, RowLoc* pos); // Updates RowLoc object, 1 if not found, 0 if found 
 int table_find_name(Table* table, const char* name, RowLoc* pos); // Updates RowLoc object, 1 if not found, 0 if found
+int table_get_row(Table* table, int64_t id, Row* row); // Copies the row with the given id, 0 if found, 1 if not
 int table_insert(Table* table, const Row* row) ;// Inserts row, in the first empty page; const Row* as Row can be shallow copied
+int table_insert_batch(Table* table, const Row* rows, size_t n); // Inserts n rows into new pages at the end of the table, all or none; returns 0 on success, 1 on failure. If only the closing checkpoint fails, the rows stay in the table in memory but may not be on disk, so a crash can lose them
 int table_insert_record(Table* table, int64_t id, const char* name, const char* email); // Requires updation if struct Row is updated
 int table_delete_pos(Table* table, RowLoc pos); // Deletes row at the given position, returns 0 on success, 1 on failure
 int table_delete_id(Table* table, int64_t id);
 int table_delete_name(Table* table, const char* name);
+int table_update_row(Table* table, RowLoc pos, const char* name, const char* email); // Replaces name and email of the row at pos, returns 0 on success, 1 on failure
 void table_print(Table* table); // Prints whole table
-Page* table_get_page(Table* table, int page_id); // Returns the page with the given ID, NULL if not found
+size_t table_scan_range(Table* table, int64_t lo, int64_t hi, TableScanCallback callback, void* arg); // Calls callback on a copy of every row with lo <= id <= hi in id order, returns how many; rows changed during the scan may show either way
+const Page* table_pin_page(Table* table, int page_id); // Returns the page pinned and share-latched, NULL if not found; read-only, rows change through the functions above. Every pin needs a table_unpin_page
+void table_unpin_page(Table* table, int page_id); // Releases a page from table_pin_page
+int table_delete_files(Table* table); // Deletes the table's files from disk, returns how many were deleted; the table must be freed afterwards
 
 #endif //TABLE_H
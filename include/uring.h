@@ -0,0 +1,30 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Minimal io_uring ring for batched file I/O, driven through the raw system calls (no liburing).
+// Reads, writes and fsyncs are queued into a batch, then io_ring_submit hands the whole batch to the kernel and
+// waits for all of it with a single io_uring_enter call, so a batch of n pages costs one system call rather
+// than n. A ring is not thread-safe: each thread doing I/O needs its own, or a lock around it.
+//
+// io_ring_create returns NULL where io_uring is missing or blocked (old kernels, seccomp filters in
+// containers); callers then do the same I/O with pread / pwrite / fsync.
+
+#define IO_RING_ENTRIES 64 // Default batch size
+
+typedef struct IoRing IoRing;
+
+IoRing* io_ring_create(unsigned entries); // entries is rounded up to a power of two by the kernel; NULL if unavailable
+void io_ring_free(IoRing* ring);
+unsigned io_ring_space(const IoRing* ring); // Operations that can still be queued into the current batch
+// Queue an operation into the current batch; they return its slot in the batch, or -1 if the batch is full
+int io_ring_read(IoRing* ring, int fd, void* buf, size_t len, off_t offset);
+int io_ring_write(IoRing* ring, int fd, const void* buf, size_t len, off_t offset);
+int io_ring_fsync(IoRing* ring, int fd); // Starts only once everything queued before it has completed
+int io_ring_submit(IoRing* ring); // Submits the batch and waits for all of it; 0 on success, -1 if the ring itself failed
+int64_t io_ring_result(const IoRing* ring, int slot); // Result of an operation of the last batch: bytes transferred or 0, -errno on failure
+
+#endif //URING_H
@@ -0,0 +1,105 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "page.h" // For Row
+
+// Write-ahead log of row changes. Every insert, update and delete appends a small redo record naming the
+// page, the slot and the row's new contents (or its removal), and the change is durable once the record is.
+// A record also carries what the change did to the table's bookkeeping (row count, free-page list), so
+// replaying the records after a checkpoint restores the whole table state without reading other pages.
+// Records are appended to a memory buffer and written with one write + fdatasync per commit; while one
+// commit syncs, the commits arriving meanwhile queue their records behind it and share the next sync
+// (group commit), so concurrent writers pay for one sequential append rather than one random page write each.
+//
+// A record's log sequence number (LSN) is the log position just past it. LSNs keep growing across
+// wal_truncate, and a page stores the LSN of the last change applied to it, so replaying a record onto a page
+// that already has it is skipped. Once a checkpoint has every change up to some LSN on disk, wal_truncate
+// drops the records up to it, so recovery only replays the tail.
+
+#define WAL_FILE "wal.log" // Name of the log inside the data directory
+#define WAL_MAGIC 0x4C4C4157 // "WALL", marks a log file
+#define WAL_VERSION 2 // Version 1 logs, whose records lack the state after the change, are read but not appended to
+#define WAL_BUFFER_SIZE (64 * 1024) // Initial size of each append buffer; they grow if a group needs more
+#define WAL_CHECKPOINT_BYTES (4 << 20) // Default log size that calls for a checkpoint
+#define WAL_CHECKPOINT_INTERVAL_MS 30000 // Default time after which a non-empty log calls for a checkpoint
+
+typedef enum {
+    WAL_PUT_ROW = 1, // The slot holds the record's row, whether it was free or not
+    WAL_DELETE_ROW = 2 // The slot is free
+} WalRecordType;
+
+typedef struct { // A record as appended, and as passed to the replay callback
+    WalRecordType type;
+    int32_t page_id;
+    int32_t slot;
+    Row row;              // The row's id for both types; name and email only for WAL_PUT_ROW
+    bool has_state;       // False for records of a version 1 log, which carry only the fields above
+    // State after the change
+    uint8_t in_free_list; // Page header fields of page_id
+    int32_t next_free;
+    int32_t free_head;    // Table fields
+    uint64_t num_rows;
+} WalRecord;
+
+typedef struct {
+    uint32_t commit_delay_us; // How long a commit waits for others to join its sync; 0 syncs at once
+    size_t checkpoint_bytes;  // Log size at which wal_checkpoint_due asks for a checkpoint; 0 never
+    uint32_t checkpoint_interval_ms; // Time since the last checkpoint at which it asks for one if the log is not empty; 0 never
+} WalConfig;
+
+typedef struct {
+    uint64_t records;     // Records appended since open
+    uint64_t bytes;       // Bytes appended since open
+    uint64_t commits;     // wal_commit calls that had to wait for a sync
+    uint64_t syncs;       // fdatasync calls; commits / syncs is the average group size
+    uint64_t durable_lsn; // Everything up to here is on disk
+    uint64_t log_bytes;   // Current size of the log file
+    uint64_t truncations; // wal_truncate calls, i.e. completed checkpoints
+} WalStats;
+
+typedef struct {
+    int fd;
+    char path[256];
+    uint32_t commit_delay_us;
+    size_t checkpoint_bytes;
+    uint32_t checkpoint_interval_ms;
+    uint64_t truncated_ns;   // Monotonic time of the last truncation, or of the open
+    pthread_mutex_t lock;
+    pthread_cond_t synced;   // Broadcast when a group commit finishes
+    // Records are appended to buf; a commit swaps it with spare, writes spare and syncs without the lock
+    char* buf;
+    size_t buf_len;
+    size_t buf_cap;
+    char* spare;
+    size_t spare_cap;
+    bool syncing;            // A commit is writing spare
+    bool failed;             // A write or sync failed; nothing is durable past durable_lsn any more
+    bool deleted;            // Set by wal_delete_file, so nothing is written any more
+    uint32_t version;        // Record format of the file; records are only appended once it is WAL_VERSION
+    uint64_t base_lsn;       // LSN of the first byte after the file header
+    uint64_t next_lsn;       // LSN the next record ends after; everything up to it is appended
+    uint64_t durable_lsn;    // Everything up to it is written and synced
+    uint64_t file_end;       // LSN of the end of the file, where the next group is written
+    WalStats stats;
+} Wal;
+
+WalConfig wal_default_config(void); // Syncs every commit at once, checkpoints every WAL_CHECKPOINT_BYTES or WAL_CHECKPOINT_INTERVAL_MS
+Wal* wal_open(const char* data_dir, const WalConfig* config); // Opens or creates data_dir/WAL_FILE, dropping a torn tail; NULL config uses the defaults. NULL for a log of an unknown version
+void wal_close(Wal* wal); // Writes out appended records and closes the log; they are not synced
+uint64_t wal_append(Wal* wal, const WalRecord* record); // Buffers a record, returns its LSN, 0 on failure
+int wal_commit(Wal* wal, uint64_t lsn); // Returns once every record up to lsn is durable, 0 on success, 1 on failure
+long wal_replay(Wal* wal, uint64_t after_lsn, int (*apply)(const WalRecord* record, uint64_t lsn, void* arg), void* arg); // Calls apply on every record with an LSN above after_lsn in order, returns how many, -1 if apply failed
+int wal_truncate(Wal* wal, uint64_t lsn); // Drops the records up to lsn once their changes are on disk in the pages; lsn past the end empties the log and moves it there. Returns 0 on success
+bool wal_failed(Wal* wal); // True while nothing appended can become durable: a write or sync failed, the file was deleted, or it is a version 1 log; until wal_truncate empties the log
+uint64_t wal_end_lsn(Wal* wal); // LSN of the last record appended, or where the log starts if it is empty
+uint64_t wal_start_lsn(Wal* wal); // LSN of the first byte of the log; records up to it were truncated
+bool wal_checkpoint_due(Wal* wal); // True once the log has grown or aged past the configured checkpoint limits
+void wal_get_stats(Wal* wal, WalStats* stats);
+int wal_delete_file(Wal* wal); // Deletes the log file, returns 1 if it was deleted; the log must be closed afterwards
+
+#endif //WAL_H
@@ -1,172 +1,709 @@
 #include "btree.h"
+#include "keysearch.h"
 #include <string.h>
 
-struct Item {
-    int64_t key;
-    RowLoc pos;
-};
-
 // Forward declarations of helper functions.
-static void deleteFromNode(IndexNode* node, int64_t key);
+static int deleteFromNode(BTree* tree, int node_id, int64_t key);
+
+// --- Node Pages ---
+// Nodes are referred to by page id. Lookups and changes pin the nodes they use with pinNode, so a node pointer
+// stays valid until its releaseNode, and latch them on the way down (latch coupling): a lookup latches a child
+// shared before letting go of its parent, and the writer latches every node a split, borrow or merge touches
+// exclusively, together with their parent, so a lookup never passes through half of one. tree->latch is held
+// shared by every lookup from reading the root to its end, and exclusively only to move the root or rebuild
+// the whole tree. The writer reads nodes no lookup can change without a latch.
+// getNode returns an unpinned pointer, valid only while fewer than CACHE_MIN_PAGES - 1 other pages are
+// fetched; it is used on nodes the caller has pinned, and by cursors and bulk loading, which need the tree
+// to themselves.
+
+static IndexNode* getNode(BTree* tree, int page_id) {
+    return (IndexNode*)pager_get(tree->pager, page_id);
+}
+
+static IndexNode* pinNode(BTree* tree, int page_id, PagerLatch latch) {
+    return (IndexNode*)pager_pin(tree->pager, page_id, latch);
+}
+
+static void releaseNode(BTree* tree, int page_id, PagerLatch latch) {
+    pager_unpin(tree->pager, page_id, latch, false); // Changed nodes are marked with markNode
+}
+
+static void markNode(BTree* tree, int page_id) {
+    pager_mark_dirty(tree->pager, page_id);
+}
+
+// Copies count (key, RowLoc) pairs between nodes or within one node; the ranges may overlap
+static void moveItems(IndexNode* dst, int dst_idx, IndexNode* src, int src_idx, int count) {
+    if (count <= 0) {
+        return;
+    }
+    memmove(&dst->keys[dst_idx], &src->keys[src_idx], count * sizeof(int64_t));
+    memmove(&dst->locs[dst_idx], &src->locs[src_idx], count * sizeof(RowLoc));
+}
+
+static void moveChildren(IndexNode* dst, int dst_idx, IndexNode* src, int src_idx, int count) {
+    if (count <= 0) {
+        return;
+    }
+    memmove(&dst->child[dst_idx], &src->child[src_idx], count * sizeof(int32_t));
+}
+
+static Item getItem(IndexNode* node, int idx) {
+    Item item = { .key = node->keys[idx], .pos = node->locs[idx] };
+    return item;
+}
+
+static void setItem(IndexNode* node, int idx, Item item) {
+    node->keys[idx] = item.key;
+    node->locs[idx] = item.pos;
+}
+
+static void storeMeta(BTree* tree) {
+    IndexMeta* meta = (IndexMeta*)pager_pin(tree->pager, 0, PAGER_LATCH_NONE); // Only the writer uses page 0
+    if (meta == NULL) {
+        printf("Failed to access the index header page!\n");
+        return;
+    }
+    *meta = tree->meta;
+    pager_unpin(tree->pager, 0, PAGER_LATCH_NONE, true);
+}
 
-static IndexNode* createNode() {
-    IndexNode* node = calloc(1, sizeof(IndexNode));
+// Returns a new empty node, latched exclusively, and its page id in *page_id; reuses freed pages first.
+// NULL if no page could be had.
+static IndexNode* createNode(BTree* tree, int* page_id) {
+    IndexNode* node;
+    if (tree->meta.free_head != BTREE_NIL) {
+        *page_id = tree->meta.free_head;
+        node = pinNode(tree, *page_id, PAGER_LATCH_EXCLUSIVE); // Unreachable, so no lookup is waiting for it
+        if (node != NULL) {
+            tree->meta.free_head = node->child[0];
+        }
+    } else {
+        *page_id = tree->meta.num_pages;
+        node = pinNode(tree, *page_id, PAGER_LATCH_EXCLUSIVE);
+        if (node != NULL) {
+            tree->meta.num_pages++;
+        }
+    }
     if (node == NULL) {
-        perror("Failed to allocate memory for B-Tree Node");
+        perror("Failed to allocate B-Tree Node page");
         return NULL;
     }
-    // All pointers are already NULL and values are 0 due to calloc.
+    storeMeta(tree);
+    memset(node, 0, sizeof(IndexNode));
+    markNode(tree, *page_id);
     return node;
 }
 
-int index_find(IndexNode** root, int64_t key, RowLoc* pos) {
-    if (root == NULL || *root == NULL) {
+// Puts a node page on the free list; the caller has it latched exclusively
+static void freeNode(BTree* tree, int page_id) {
+    IndexNode* node = getNode(tree, page_id);
+    node->filled = 0;
+    node->children = 0;
+    node->child[0] = tree->meta.free_head;
+    markNode(tree, page_id);
+    tree->meta.free_head = page_id;
+    storeMeta(tree);
+}
+
+static void resetMeta(BTree* tree) {
+    tree->meta.magic = BTREE_MAGIC;
+    tree->meta.order = N;
+    tree->meta.clean = 0;
+    tree->meta.root = BTREE_NIL;
+    tree->meta.num_pages = 1; // Page 0 is the header
+    tree->meta.free_head = BTREE_NIL;
+    tree->meta.checkpoint_lsn = 0;
+}
+
+// Empties the tree and cuts the file back to its header. The unclean header is synced before the nodes go,
+// so a crash during the rebuild that follows is noticed on the next open.
+static void clearTree(BTree* tree) {
+    pthread_rwlock_wrlock(&tree->latch);
+    resetMeta(tree);
+    tree->needs_rebuild = true;
+    storeMeta(tree);
+    pager_sync(tree->pager);
+    pager_truncate(tree->pager, 1);
+    pager_sync(tree->pager);
+    pthread_rwlock_unlock(&tree->latch);
+}
+
+BTree* open_index(const char* data_dir, const PagerConfig* config) {
+    BTree* tree = calloc(1, sizeof(BTree));
+    if (tree == NULL) {
+        perror("Failed to allocate memory for B-Tree");
+        return NULL;
+    }
+    PagerConfig index_config = config != NULL ? *config : pager_default_config();
+    index_config.journal = true; // A crash must not leave half of a split or merge on disk
+    tree->pager = create_pager(data_dir, &index_config);
+    if (tree->pager == NULL) {
+        free(tree);
+        return NULL;
+    }
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    // Moving the root waits for the lookups in progress; new ones must not keep overtaking it
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&tree->latch, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    IndexMeta* meta = (IndexMeta*)pager_get(tree->pager, 0); // A new file yields a zeroed page
+    if (meta == NULL) {
+        free_pager(tree->pager);
+        pthread_rwlock_destroy(&tree->latch);
+        free(tree);
+        return NULL;
+    }
+    tree->meta = *meta;
+    if (tree->meta.magic != BTREE_MAGIC || tree->meta.order != N || !tree->meta.clean) {
+        // Missing, built with another BTREE_ORDER, or left mid-rebuild (or by an older build without the journal):
+        // the nodes cannot be used or may not match the table pages
+        clearTree(tree);
+    }
+    return tree;
+}
+
+int index_find(BTree* tree, int64_t key, RowLoc* pos) {
+    if (tree == NULL) {
         return 1; // Not found
     }
-    IndexNode* current = *root;
-    while (current != NULL) {
-        int i = 0;
-        while (i < current->filled && key > current->values[i]->key) {
-            i++;
-        }
+    pthread_rwlock_rdlock(&tree->latch);
+    int found = 1;
+    int current = tree->meta.root;
+    IndexNode* node = current == BTREE_NIL ? NULL : pinNode(tree, current, PAGER_LATCH_SHARED);
+    while (node != NULL) {
+        int i = keysearch(node->keys, node->filled, key);
         // Check if the key is found at the current position.
-        if (i < current->filled && key == current->values[i]->key) {
+        if (i < node->filled && key == node->keys[i]) {
             if (pos != NULL) {
-                *pos = current->values[i]->pos; // Update RowLoc with the position.
+                *pos = node->locs[i]; // Update RowLoc with the position.
             }
-            return 0; // Found
+            found = 0;
+            break;
         }
         // If the current node is a leaf, the search ends here.
-        if (current->children == 0) {
-            return 1; // Not found
+        if (node->children == 0) {
+            break;
         }
-        // Otherwise, continue the search in the appropriate child node.
-        current = current->child[i];
+        // Otherwise, continue the search in the appropriate child node, latched before its parent is let go.
+        int child_id = node->child[i];
+        IndexNode* child = pinNode(tree, child_id, PAGER_LATCH_SHARED);
+        releaseNode(tree, current, PAGER_LATCH_SHARED);
+        current = child_id;
+        node = child;
+    }
+    if (node != NULL) {
+        releaseNode(tree, current, PAGER_LATCH_SHARED);
     }
-    return 1; // Not found
+    pthread_rwlock_unlock(&tree->latch);
+    return found;
 }
 
-static void splitChild(IndexNode* parent, int child_idx) {
-    // The child to be split, which must be full (2*MIN - 1 keys).
-    IndexNode* child_to_split = parent->child[child_idx];
-    
+// Appends the items of a node's subtree with from <= key <= to to out, in key order, until max are collected.
+// The node is latched shared by the caller; each child is latched while it is visited. Returns false once the
+// range or out is used up.
+static bool rangeCollect(BTree* tree, IndexNode* node, int64_t from, int64_t to, Item* out, size_t max, size_t* count) {
+    for (int j = keysearch(node->keys, node->filled, from); j <= node->filled; j++) {
+        if (node->children > 0) {
+            int child_id = node->child[j];
+            IndexNode* child = pinNode(tree, child_id, PAGER_LATCH_SHARED);
+            if (child == NULL) {
+                return false;
+            }
+            bool more = rangeCollect(tree, child, from, to, out, max, count);
+            releaseNode(tree, child_id, PAGER_LATCH_SHARED);
+            if (!more) {
+                return false;
+            }
+        }
+        if (j == node->filled) {
+            break;
+        }
+        if (node->keys[j] > to || *count == max) {
+            return false;
+        }
+        if (*count > 0 && out[*count - 1].key >= node->keys[j]) {
+            continue; // A key a delete is moving up from a leaf shows in both places for a moment
+        }
+        out[(*count)++] = getItem(node, j);
+    }
+    return true;
+}
+
+size_t index_range(BTree* tree, int64_t from, int64_t to, Item* out, size_t max) {
+    if (tree == NULL || out == NULL || max == 0 || from > to) {
+        return 0;
+    }
+    size_t count = 0;
+    pthread_rwlock_rdlock(&tree->latch);
+    int root_id = tree->meta.root;
+    IndexNode* root = root_id == BTREE_NIL ? NULL : pinNode(tree, root_id, PAGER_LATCH_SHARED);
+    if (root != NULL) {
+        // The root stays latched, so no change gets past it until the batch is complete
+        rangeCollect(tree, root, from, to, out, max, &count);
+        releaseNode(tree, root_id, PAGER_LATCH_SHARED);
+    }
+    pthread_rwlock_unlock(&tree->latch);
+    return count;
+}
+
+// --- Cursors ---
+
+// Pushes a node on the cursor path with the given slot, returns 1 if the path is too deep.
+static int cursorPush(IndexCursor* cursor, int node_id, int slot) {
+    if (cursor->depth == BTREE_MAX_DEPTH) {
+        printf("Error: B-Tree deeper than %d levels\n", BTREE_MAX_DEPTH);
+        cursor->depth = 0;
+        return 1;
+    }
+    cursor->node[cursor->depth] = node_id;
+    cursor->slot[cursor->depth] = slot;
+    cursor->depth++;
+    return 0;
+}
+
+// Descends from node_id to its leftmost key (or rightmost when rightmost is set), pushing the path.
+static int cursorDescend(IndexCursor* cursor, int node_id, bool rightmost) {
+    while (true) {
+        IndexNode* node = getNode(cursor->tree, node_id);
+        int slot = rightmost ? (node->children > 0 ? node->filled : node->filled - 1) : 0;
+        if (cursorPush(cursor, node_id, slot) != 0) {
+            return 1;
+        }
+        if (node->children == 0) {
+            return 0;
+        }
+        node_id = node->child[slot];
+    }
+}
+
+// Pops finished nodes after the last key of a subtree: the key following child c of a parent is its key c.
+static int cursorClimbNext(IndexCursor* cursor) {
+    while (cursor->depth > 0) {
+        int top = cursor->depth - 1;
+        if (cursor->slot[top] < getNode(cursor->tree, cursor->node[top])->filled) {
+            return 0;
+        }
+        cursor->depth--;
+    }
+    return 1;
+}
+
+// Pops finished nodes before the first key of a subtree: the key preceding child c of a parent is its key c - 1.
+static int cursorClimbPrev(IndexCursor* cursor) {
+    while (cursor->depth > 0) {
+        int top = cursor->depth - 1;
+        if (cursor->slot[top] > 0) {
+            cursor->slot[top]--;
+            return 0;
+        }
+        cursor->depth--;
+    }
+    return 1;
+}
+
+int index_seek(IndexCursor* cursor, BTree* tree, int64_t key) {
+    cursor->tree = tree;
+    cursor->depth = 0;
+    if (tree == NULL || tree->meta.root == BTREE_NIL) {
+        return 1;
+    }
+    int current = tree->meta.root;
+    while (true) {
+        IndexNode* node = getNode(tree, current);
+        int i = keysearch(node->keys, node->filled, key);
+        if (cursorPush(cursor, current, i) != 0) {
+            return 1;
+        }
+        if ((i < node->filled && node->keys[i] == key) || node->children == 0) {
+            break; // On the key, or at the leaf slot where it would be
+        }
+        current = node->child[i];
+    }
+    // In a leaf, slot == filled means every key here is smaller; the answer is then an ancestor's key
+    return cursorClimbNext(cursor);
+}
+
+int index_seek_first(IndexCursor* cursor, BTree* tree) {
+    cursor->tree = tree;
+    cursor->depth = 0;
+    if (tree == NULL || tree->meta.root == BTREE_NIL) {
+        return 1;
+    }
+    return cursorDescend(cursor, tree->meta.root, false);
+}
+
+int index_seek_last(IndexCursor* cursor, BTree* tree) {
+    cursor->tree = tree;
+    cursor->depth = 0;
+    if (tree == NULL || tree->meta.root == BTREE_NIL) {
+        return 1;
+    }
+    return cursorDescend(cursor, tree->meta.root, true);
+}
+
+int index_next(IndexCursor* cursor) {
+    if (cursor->depth == 0) {
+        return 1;
+    }
+    int top = cursor->depth - 1;
+    IndexNode* node = getNode(cursor->tree, cursor->node[top]);
+    cursor->slot[top]++;
+    if (node->children > 0) { // The next key is the smallest one of the right subtree
+        return cursorDescend(cursor, node->child[cursor->slot[top]], false);
+    }
+    return cursorClimbNext(cursor);
+}
+
+int index_prev(IndexCursor* cursor) {
+    if (cursor->depth == 0) {
+        return 1;
+    }
+    int top = cursor->depth - 1;
+    IndexNode* node = getNode(cursor->tree, cursor->node[top]);
+    if (node->children > 0) { // The previous key is the largest one of the left subtree
+        return cursorDescend(cursor, node->child[cursor->slot[top]], true);
+    }
+    return cursorClimbPrev(cursor);
+}
+
+int index_cursor_item(const IndexCursor* cursor, Item* item) {
+    if (cursor->depth == 0) {
+        return 1;
+    }
+    int top = cursor->depth - 1;
+    *item = getItem(getNode(cursor->tree, cursor->node[top]), cursor->slot[top]);
+    return 0;
+}
+
+// The parent and the child are latched exclusively by the caller, the new sibling until the split is done.
+// Returns 0 on success, 1 if no node could be allocated, in which case nothing was changed.
+static int splitChild(BTree* tree, int parent_id, int child_idx) {
     // Create a new node to store the second half of the keys from the split child.
-    IndexNode* new_sibling = createNode();
+    int sibling_id;
+    IndexNode* new_sibling = createNode(tree, &sibling_id);
+    if (new_sibling == NULL) {
+        return 1;
+    }
+
+    IndexNode* parent = getNode(tree, parent_id);
+    int child_id = parent->child[child_idx];
+    // The child to be split, which must be full (2*MIN - 1 keys).
+    IndexNode* child_to_split = getNode(tree, child_id);
     new_sibling->filled = MIN - 1;
 
     // Copy the last (MIN - 1) keys from the child_to_split to the new_sibling.
-    for (int j = 0; j < MIN - 1; j++) {
-        new_sibling->values[j] = child_to_split->values[j + MIN];
-    }
+    moveItems(new_sibling, 0, child_to_split, MIN, MIN - 1);
 
     // If the split child is not a leaf, copy its last MIN children to the new_sibling.
     if (child_to_split->children > 0) {
         new_sibling->children = MIN;
-        for (int j = 0; j < MIN; j++) {
-            new_sibling->child[j] = child_to_split->child[j + MIN];
-        }
+        moveChildren(new_sibling, 0, child_to_split, MIN, MIN);
         child_to_split->children = MIN;
     }
 
     // Reduce the number of keys in the original child.
     child_to_split->filled = MIN - 1;
 
-    // Make space in the parent for the new child pointer.
-    for (int j = parent->filled; j >= child_idx + 1; j--) {
-        parent->child[j + 1] = parent->child[j];
-    }
-
-    // Link the new sibling to the parent.
-    parent->child[child_idx + 1] = new_sibling;
+    // Make space in the parent for the new child pointer, and link the new sibling to the parent.
+    moveChildren(parent, child_idx + 2, parent, child_idx + 1, parent->filled - child_idx);
+    parent->child[child_idx + 1] = sibling_id;
     parent->children++;
 
-    // Make space in the parent for the median key from the split child.
-    for (int j = parent->filled - 1; j >= child_idx; j--) {
-        parent->values[j + 1] = parent->values[j];
-    }
-
-    // Copy the median key from the split child to the parent.
-    parent->values[child_idx] = child_to_split->values[MIN - 1];
+    // Make space in the parent for the median key from the split child, and copy it up.
+    moveItems(parent, child_idx + 1, parent, child_idx, parent->filled - child_idx);
+    moveItems(parent, child_idx, child_to_split, MIN - 1, 1);
     parent->filled++;
+
+    markNode(tree, parent_id);
+    markNode(tree, child_id);
+    markNode(tree, sibling_id);
+    releaseNode(tree, sibling_id, PAGER_LATCH_EXCLUSIVE);
+    return 0;
 }
 
-static void index_insert_nonfull(IndexNode* node, int64_t key, RowLoc pos) {
-    int i = node->filled - 1;
+// Inserts into the subtree of a node that is not full and is latched exclusively by the caller, moving down
+// one level at a time: a full child is split while its parent is still latched, and only then is the parent
+// released. Returns 0 on success, 1 if a node could not be had; the key is then not inserted, but every node
+// is left whole.
+static int index_insert_nonfull(BTree* tree, int node_id, int64_t key, RowLoc pos) {
+    while (true) {
+        IndexNode* node = getNode(tree, node_id);
+        // Slot of the new key in a leaf, or the child that is going to be the root of the new subtree.
+        int i = keysearch(node->keys, node->filled, key);
 
-    // If the node is a leaf, insert the new key here.
-    if (node->children == 0) {
-        // Find the correct position for the new key and shift existing keys.
-        while (i >= 0 && key < node->values[i]->key) {
-            node->values[i + 1] = node->values[i];
-            i--;
-        }
+        // If the node is a leaf, insert the new key here.
+        if (node->children == 0) {
+            // Shift the greater keys right to make room.
+            moveItems(node, i + 1, node, i, node->filled - i);
 
-        Item* new_item = malloc(sizeof(Item));
-        if (!new_item) {
-            perror("Failed to allocate memory for new Item");
-            return;
+            node->keys[i] = key;
+            node->locs[i] = pos;
+            node->filled++;
+            markNode(tree, node_id);
+            releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+            return 0;
         }
-        new_item->key = key;
-        new_item->pos = pos;
-        
-        node->values[i + 1] = new_item;
-        node->filled++;
-    } else { // If the node is internal.
-        // Find the child that is going to be the root of the new subtree.
-        while (i >= 0 && key < node->values[i]->key) {
-            i--;
+        // If the node is internal.
+        int child_id = node->child[i];
+        IndexNode* child = pinNode(tree, child_id, PAGER_LATCH_EXCLUSIVE);
+        if (child == NULL) {
+            releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+            return 1;
         }
-        i++;
-
         // If the found child is full, split it first.
-        if (node->child[i]->filled == (2 * MIN - 1)) {
-            splitChild(node, i);
+        if (child->filled == (2 * MIN - 1)) {
+            if (splitChild(tree, node_id, i) != 0) {
+                releaseNode(tree, child_id, PAGER_LATCH_EXCLUSIVE);
+                releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+                return 1;
+            }
             // After splitting, the key might need to go into the new sibling.
-            if (key > node->values[i]->key) {
-                i++;
+            if (key > node->keys[i]) {
+                releaseNode(tree, child_id, PAGER_LATCH_EXCLUSIVE);
+                child_id = node->child[i + 1];
+                if (pinNode(tree, child_id, PAGER_LATCH_EXCLUSIVE) == NULL) {
+                    releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+                    return 1;
+                }
+            }
+        }
+        releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+        node_id = child_id;
+    }
+}
+
+// Creates the root of an empty tree holding just the key, or puts a new root above a full one and splits
+// it. Called with tree->latch held exclusively, so no lookup is on its way down from the old root.
+// Returns 0 on success, 1 if no node could be allocated; the old root then stays the root.
+static int growRoot(BTree* tree, int64_t key, RowLoc pos) {
+    int root_id;
+    IndexNode* root = createNode(tree, &root_id);
+    if (root == NULL) {
+        return 1;
+    }
+    if (tree->meta.root == BTREE_NIL) {
+        root->keys[0] = key;
+        root->locs[0] = pos;
+        root->filled = 1;
+    } else {
+        int old_root = tree->meta.root;
+        root->children = 1;
+        root->child[0] = old_root;
+        bool pinned = pinNode(tree, old_root, PAGER_LATCH_EXCLUSIVE) != NULL;
+        if (!pinned || splitChild(tree, root_id, 0) != 0) {
+            if (pinned) {
+                releaseNode(tree, old_root, PAGER_LATCH_EXCLUSIVE);
             }
+            freeNode(tree, root_id); // Never linked into the tree
+            releaseNode(tree, root_id, PAGER_LATCH_EXCLUSIVE);
+            return 1;
         }
-        index_insert_nonfull(node->child[i], key, pos);
+        releaseNode(tree, old_root, PAGER_LATCH_EXCLUSIVE);
     }
+    markNode(tree, root_id);
+    releaseNode(tree, root_id, PAGER_LATCH_EXCLUSIVE);
+    tree->meta.root = root_id;
+    storeMeta(tree);
+    return 0;
 }
 
 /**
  * @brief Inserts a new key-position pair into the B-Tree.
- * @param root Pointer to the root of the tree.
+ * @param tree The index.
  * @param key The key to insert.
  * @param pos The RowLoc associated with the key.
+ * @return 0 on success, 1 if a node could not be had; the tree then stays whole but lacks the key.
+ */
+int index_insert(BTree* tree, int64_t key, RowLoc pos) {
+    if (tree == NULL) {
+        return 0;
+    }
+
+    // The root changes only here and in index_delete, and only this thread changes the tree, so it is read unlatched
+    int root_id = tree->meta.root;
+    bool empty = root_id == BTREE_NIL;
+    IndexNode* root = empty ? NULL : pinNode(tree, root_id, PAGER_LATCH_NONE);
+    if (!empty && root == NULL) {
+        return 1;
+    }
+    bool full = root != NULL && root->filled == (2 * MIN - 1);
+    if (root != NULL) {
+        releaseNode(tree, root_id, PAGER_LATCH_NONE);
+    }
+    // If the tree is empty, create a new root; if the root is full, the tree must grow in height.
+    if (empty || full) {
+        pthread_rwlock_wrlock(&tree->latch);
+        int failed = growRoot(tree, key, pos);
+        pthread_rwlock_unlock(&tree->latch);
+        if (empty || failed) {
+            return failed;
+        }
+    }
+    root_id = tree->meta.root;
+    if (pinNode(tree, root_id, PAGER_LATCH_EXCLUSIVE) == NULL) {
+        return 1;
+    }
+    return index_insert_nonfull(tree, root_id, key, pos);
+}
+
+
+// --- Bulk Loading ---
+
+static int compareItems(const void* a, const void* b) {
+    int64_t ka = ((const Item*)a)->key;
+    int64_t kb = ((const Item*)b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+/**
+ * @brief Builds the B-Tree bottom-up from unsorted items, in one pass per level.
+ * @param tree The index, which must be empty.
+ * @param items The (key, RowLoc) pairs; sorted and then overwritten in place.
+ * @param n Number of items.
+ *
+ * Each level is cut into as few nodes as possible: ceil((count + 1) / 2*MIN) nodes hold count - (nodes - 1)
+ * keys spread evenly (so every node has between MIN - 1 and 2*MIN - 1 keys), and the one key between two
+ * neighbouring nodes moves up as a separator. The separators and the new node ids form the next level,
+ * until a level fits in a single node, the root. Called with tree->latch held exclusively.
+ * @return 0 on success, 1 if memory or a node could not be had; the tree is then left empty, with some of
+ * its pages used.
  */
-void index_insert(IndexNode** root, int64_t key, RowLoc pos) {
-    IndexNode* r = *root;
-
-    // If the tree is empty, create a new root.
-    if (r == NULL) {
-        *root = createNode();
-        Item* new_item = malloc(sizeof(Item));
-        if (!new_item) {
-             perror("Failed to allocate memory for new Item");
-             return;
+static int bulkLoad(BTree* tree, Item* items, size_t n) {
+    if (tree->meta.root != BTREE_NIL) {
+        printf("Bulk load needs an empty index!\n");
+        return 1;
+    }
+    qsort(items, n, sizeof(Item), compareItems);
+
+    int32_t* children = NULL; // Node ids of the level below, count + 1 of them; NULL while building leaves
+    size_t count = n;
+    while (true) {
+        size_t nodes = (count + 1 + 2 * MIN - 1) / (2 * MIN);
+        size_t keys = count - (nodes - 1); // Keys that stay at this level
+        int32_t* ids = malloc(nodes * sizeof(int32_t));
+        if (ids == NULL) {
+            perror("Failed to allocate memory for bulk load");
+            free(children);
+            return 1;
+        }
+        size_t in = 0, up = 0, c = 0;
+        for (size_t j = 0; j < nodes; j++) {
+            size_t take = keys / nodes + (j < keys % nodes ? 1 : 0);
+            int node_id;
+            IndexNode* node = createNode(tree, &node_id);
+            if (node == NULL) {
+                free(ids);
+                free(children);
+                return 1;
+            }
+            for (size_t k = 0; k < take; k++) {
+                setItem(node, k, items[in++]);
+            }
+            node->filled = take;
+            if (children != NULL) {
+                for (size_t k = 0; k <= take; k++) {
+                    node->child[k] = children[c++];
+                }
+                node->children = take + 1;
+            }
+            markNode(tree, node_id);
+            releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+            ids[j] = node_id;
+            if (j + 1 < nodes) {
+                items[up++] = items[in++]; // Separator moves up a level; up never passes in, so this is safe in place
+            }
+        }
+        free(children);
+        children = ids;
+        count = up;
+        if (nodes == 1) {
+            break;
         }
-        new_item->key = key;
-        new_item->pos = pos;
-        (*root)->values[0] = new_item;
-        (*root)->filled = 1;
-        return;
     }
+    tree->meta.root = children[0];
+    free(children);
+    storeMeta(tree);
+    return 0;
+}
 
-    // If the root is full, the tree must grow in height.
-    if (r->filled == (2 * MIN - 1)) {
-        IndexNode* new_root = createNode();
-        *root = new_root;
-        new_root->children = 1;
-        new_root->child[0] = r;
-        splitChild(new_root, 0);
-        index_insert_nonfull(new_root, key, pos);
-    } else {
-        index_insert_nonfull(r, key, pos);
+int index_bulk_load(BTree* tree, Item* items, size_t n) {
+    if (tree == NULL || items == NULL || n == 0) {
+        return 0;
+    }
+    pthread_rwlock_wrlock(&tree->latch);
+    int ret = bulkLoad(tree, items, n);
+    pthread_rwlock_unlock(&tree->latch);
+    return ret;
+}
+
+static int insertItems(BTree* tree, const Item* items, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (index_insert(tree, items[i].key, items[i].pos) != 0) {
+            return 1;
+        }
     }
+    return 0;
 }
 
+/**
+ * @brief Adds many new keys to the B-Tree at once.
+ * A batch that is small next to the tree is inserted in key order, so consecutive inserts walk the same
+ * path and hit cached nodes. A larger one is merged with the keys already in the tree and the whole tree
+ * is bulk loaded again, which writes every node once instead of splitting nodes over and over; lookups
+ * wait for the rebuild, as the nodes they would pass through are reused.
+ * @param tree The index.
+ * @param items The new key-position pairs, none of them already in the tree; reordered.
+ * @param n Number of items.
+ * @param existing Number of keys in the tree before the merge.
+ * @return 0 on success, 1 if memory or a node could not be had; the tree may then lack any of its keys, old or
+ * new, and must not be used.
+ */
+int index_merge(BTree* tree, Item* items, size_t n, size_t existing) {
+    if (tree == NULL || items == NULL || n == 0) {
+        return 0;
+    }
+    if (tree->meta.root == BTREE_NIL) {
+        return index_bulk_load(tree, items, n);
+    }
+    qsort(items, n, sizeof(Item), compareItems);
+    if (n < existing / BTREE_MERGE_REBUILD) {
+        return insertItems(tree, items, n);
+    }
+    // Collect the old keys in order, then build one tree over both runs
+    size_t cap = existing + n, count = 0;
+    Item* merged = malloc(cap * sizeof(Item));
+    if (merged == NULL) {
+        perror("Failed to allocate memory for index merge");
+        return insertItems(tree, items, n);
+    }
+    pthread_rwlock_wrlock(&tree->latch);
+    IndexCursor cursor;
+    for (int rc = index_seek_first(&cursor, tree); rc == 0; rc = index_next(&cursor)) {
+        if (count == cap - n) { // existing was too low, make room
+            Item* grown = realloc(merged, (2 * cap) * sizeof(Item));
+            if (grown == NULL) {
+                perror("Failed to allocate memory for index merge");
+                free(merged);
+                pthread_rwlock_unlock(&tree->latch);
+                return insertItems(tree, items, n);
+            }
+            merged = grown;
+            cap *= 2;
+        }
+        index_cursor_item(&cursor, &merged[count++]);
+    }
+    memcpy(merged + count, items, n * sizeof(Item));
+    // The old node pages are simply reused from the start of the file
+    uint32_t clean = tree->meta.clean;
+    resetMeta(tree);
+    tree->meta.clean = clean;
+    int ret = bulkLoad(tree, merged, count + n);
+    pthread_rwlock_unlock(&tree->latch);
+    free(merged);
+    return ret;
+}
 
 // --- Deletion Functions ---
 
@@ -174,107 +711,128 @@ void index_insert(IndexNode** root, int64_t key, RowLoc pos) {
  * @brief Finds the index of the first key >= k.
  */
 static int findKey(IndexNode* node, int64_t key) {
-    int idx = 0;
-    while (idx < node->filled && node->values[idx]->key < key)
-        idx++;
-    return idx;
+    return keysearch(node->keys, node->filled, key);
 }
 
 /**
- * @brief Gets the predecessor of the key at node->values[idx].
+ * @brief Gets the first or last item of a subtree.
+ * Only the writer changes nodes, so it reads them pinned but unlatched. Returns 0 on success, 1 if a node
+ * could not be pinned.
  */
-static Item* getPredecessor(IndexNode* node, int idx) {
-    IndexNode* cur = node->child[idx];
-    while (cur->children != 0) {
-        cur = cur->child[cur->filled];
+static int getEdgeItem(BTree* tree, int cur_id, bool last, Item* item) {
+    IndexNode* cur = pinNode(tree, cur_id, PAGER_LATCH_NONE);
+    while (cur != NULL && cur->children != 0) {
+        int next_id = cur->child[last ? cur->filled : 0];
+        releaseNode(tree, cur_id, PAGER_LATCH_NONE);
+        cur_id = next_id;
+        cur = pinNode(tree, cur_id, PAGER_LATCH_NONE);
     }
-    return cur->values[cur->filled - 1];
+    if (cur == NULL) {
+        return 1;
+    }
+    *item = getItem(cur, last ? cur->filled - 1 : 0);
+    releaseNode(tree, cur_id, PAGER_LATCH_NONE);
+    return 0;
 }
 
 /**
- * @brief Gets the successor of the key at node->values[idx].
+ * @brief Gets the predecessor of the key at node->keys[idx].
  */
-static Item* getSuccessor(IndexNode* node, int idx) {
-    IndexNode* cur = node->child[idx + 1];
-    while (cur->children != 0) {
-        cur = cur->child[0];
-    }
-    return cur->values[0];
+static int getPredecessor(BTree* tree, int node_id, int idx, Item* item) {
+    return getEdgeItem(tree, getNode(tree, node_id)->child[idx], true, item);
+}
+
+/**
+ * @brief Gets the successor of the key at node->keys[idx].
+ */
+static int getSuccessor(BTree* tree, int node_id, int idx, Item* item) {
+    return getEdgeItem(tree, getNode(tree, node_id)->child[idx + 1], false, item);
 }
 
+// The borrow and merge helpers below work on a node and two of its children, all latched exclusively by the caller.
+
 /**
  * @brief Borrows a key from the previous sibling.
  */
-static void borrowFromPrev(IndexNode* node, int idx) {
-    IndexNode* child = node->child[idx];
-    IndexNode* sibling = node->child[idx - 1];
+static void borrowFromPrev(BTree* tree, int node_id, int idx) {
+    IndexNode* node = getNode(tree, node_id);
+    int child_id = node->child[idx];
+    int sibling_id = node->child[idx - 1];
+    IndexNode* child = getNode(tree, child_id);
+    IndexNode* sibling = getNode(tree, sibling_id);
 
-    for (int i = child->filled - 1; i >= 0; i--)
-        child->values[i + 1] = child->values[i];
+    moveItems(child, 1, child, 0, child->filled);
 
     if (child->children != 0) {
-        for (int i = child->children -1; i >= 0; i--)
-            child->child[i + 1] = child->child[i];
+        moveChildren(child, 1, child, 0, child->children);
     }
 
-    child->values[0] = node->values[idx - 1];
+    moveItems(child, 0, node, idx - 1, 1);
 
     if (child->children != 0) {
         child->child[0] = sibling->child[sibling->children - 1];
         sibling->children--;
     }
 
-    node->values[idx - 1] = sibling->values[sibling->filled - 1];
+    moveItems(node, idx - 1, sibling, sibling->filled - 1, 1);
 
     child->filled++;
     if (child->children != 0) child->children++;
     sibling->filled--;
+
+    markNode(tree, node_id);
+    markNode(tree, child_id);
+    markNode(tree, sibling_id);
 }
 
 /**
  * @brief Borrows a key from the next sibling.
  */
-static void borrowFromNext(IndexNode* node, int idx) {
-    IndexNode* child = node->child[idx];
-    IndexNode* sibling = node->child[idx + 1];
+static void borrowFromNext(BTree* tree, int node_id, int idx) {
+    IndexNode* node = getNode(tree, node_id);
+    int child_id = node->child[idx];
+    int sibling_id = node->child[idx + 1];
+    IndexNode* child = getNode(tree, child_id);
+    IndexNode* sibling = getNode(tree, sibling_id);
 
-    child->values[child->filled] = node->values[idx];
+    moveItems(child, child->filled, node, idx, 1);
 
     if (child->children != 0) {
         child->child[child->children] = sibling->child[0];
     }
 
-    node->values[idx] = sibling->values[0];
-
-    for (int i = 1; i < sibling->filled; i++)
-        sibling->values[i - 1] = sibling->values[i];
+    moveItems(node, idx, sibling, 0, 1);
+    moveItems(sibling, 0, sibling, 1, sibling->filled - 1);
 
     if (sibling->children != 0) {
-        for (int i = 1; i < sibling->children; i++)
-            sibling->child[i - 1] = sibling->child[i];
+        moveChildren(sibling, 0, sibling, 1, sibling->children - 1);
     }
-    
+
     child->filled++;
     if (child->children != 0) child->children++;
     sibling->filled--;
     if (sibling->children != 0) sibling->children--;
+
+    markNode(tree, node_id);
+    markNode(tree, child_id);
+    markNode(tree, sibling_id);
 }
 
 /**
  * @brief Merges child[idx] with child[idx+1].
  */
-static void mergeNodes(IndexNode* node, int idx) {
-    IndexNode* left_child = node->child[idx];
-    IndexNode* right_child = node->child[idx + 1];
-
-    left_child->values[left_child->filled] = node->values[idx];
+static void mergeNodes(BTree* tree, int node_id, int idx) {
+    IndexNode* node = getNode(tree, node_id);
+    int left_id = node->child[idx];
+    int right_id = node->child[idx + 1];
+    IndexNode* left_child = getNode(tree, left_id);
+    IndexNode* right_child = getNode(tree, right_id);
 
-    for (int i = 0; i < right_child->filled; i++)
-        left_child->values[left_child->filled + 1 + i] = right_child->values[i];
+    moveItems(left_child, left_child->filled, node, idx, 1);
+    moveItems(left_child, left_child->filled + 1, right_child, 0, right_child->filled);
 
     if (right_child->children > 0) {
-        for (int i = 0; i < right_child->children; i++)
-            left_child->child[left_child->filled + 1 + i] = right_child->child[i];
+        moveChildren(left_child, left_child->filled + 1, right_child, 0, right_child->children);
     }
 
     left_child->filled += 1 + right_child->filled;
@@ -283,126 +841,234 @@ static void mergeNodes(IndexNode* node, int idx) {
     }
 
 
-    for (int i = idx + 1; i < node->filled; i++)
-        node->values[i - 1] = node->values[i];
-
-    for (int i = idx + 2; i <= node->filled; i++)
-        node->child[i - 1] = node->child[i];
+    moveItems(node, idx, node, idx + 1, node->filled - (idx + 1));
+    moveChildren(node, idx + 1, node, idx + 2, node->filled - (idx + 1));
 
     node->filled--;
     node->children--;
-    free(right_child);
+
+    markNode(tree, node_id);
+    markNode(tree, left_id);
+    freeNode(tree, right_id);
 }
 
 /**
  * @brief Fills a child node if it has fewer than MIN keys.
+ * The node and child[idx] are latched exclusively by the caller; the sibling it borrows from or merges with is
+ * latched here. Returns the page id of the child that now holds the keys of child[idx] (its left sibling after
+ * merging into it), which stays latched; the other child is released. Returns BTREE_NIL, having changed
+ * nothing, if a sibling could not be pinned.
  */
-static void fillNode(IndexNode* node, int idx) {
-    if (idx != 0 && node->child[idx - 1]->filled >= MIN)
-        borrowFromPrev(node, idx);
-    else if (idx != node->filled && node->child[idx + 1]->filled >= MIN)
-        borrowFromNext(node, idx);
-    else {
-        if (idx != node->filled)
-            mergeNodes(node, idx);
-        else
-            mergeNodes(node, idx - 1);
+static int fillNode(BTree* tree, int node_id, int idx) {
+    IndexNode* node = getNode(tree, node_id);
+    int filled = node->filled;
+    int child_id = node->child[idx];
+    int prev_id = (idx != 0) ? node->child[idx - 1] : BTREE_NIL;
+    int next_id = (idx != filled) ? node->child[idx + 1] : BTREE_NIL;
+
+    if (prev_id != BTREE_NIL) {
+        IndexNode* prev = pinNode(tree, prev_id, PAGER_LATCH_EXCLUSIVE);
+        if (prev == NULL) {
+            return BTREE_NIL;
+        }
+        if (prev->filled >= MIN) {
+            borrowFromPrev(tree, node_id, idx);
+            releaseNode(tree, prev_id, PAGER_LATCH_EXCLUSIVE);
+            return child_id;
+        }
+        if (next_id == BTREE_NIL) {
+            mergeNodes(tree, node_id, idx - 1);
+            releaseNode(tree, child_id, PAGER_LATCH_EXCLUSIVE);
+            return prev_id;
+        }
+        releaseNode(tree, prev_id, PAGER_LATCH_EXCLUSIVE);
+    }
+    IndexNode* next = pinNode(tree, next_id, PAGER_LATCH_EXCLUSIVE);
+    if (next == NULL) {
+        return BTREE_NIL;
     }
+    if (next->filled >= MIN)
+        borrowFromNext(tree, node_id, idx);
+    else
+        mergeNodes(tree, node_id, idx);
+    releaseNode(tree, next_id, PAGER_LATCH_EXCLUSIVE);
+    return child_id;
 }
 
 /**
- * @brief Recursively deletes a key from a node.
+ * @brief Deletes a key from the subtree of a node, moving down one level at a time.
+ * The node is latched exclusively by the caller. A child is latched, and fixed up if needed, before the node is
+ * released, so lookups never see a key half moved between them.
+ * Returns 0 on success, 1 if a node could not be pinned; every node is then left whole, but the key may still
+ * be in the tree, or be there twice if it was being replaced by its predecessor or successor.
  */
-static void deleteFromNode(IndexNode* node, int64_t key) {
-    int idx = findKey(node, key);
-
-    if (idx < node->filled && node->values[idx]->key == key) { // Key is in this node
-        if (node->children == 0) { // Node is a leaf
-            free(node->values[idx]);
-            for (int i = idx + 1; i < node->filled; i++)
-                node->values[i - 1] = node->values[i];
-            node->filled--;
-        } else { // Node is internal
-            if (node->child[idx]->filled >= MIN) {
-                Item* pred = getPredecessor(node, idx);
-                node->values[idx]->key = pred->key;
-                node->values[idx]->pos = pred->pos;
-                deleteFromNode(node->child[idx], pred->key);
-            } else if (node->child[idx + 1]->filled >= MIN) {
-                Item* succ = getSuccessor(node, idx);
-                node->values[idx]->key = succ->key;
-                node->values[idx]->pos = succ->pos;
-                deleteFromNode(node->child[idx + 1], succ->key);
+static int deleteFromNode(BTree* tree, int node_id, int64_t key) {
+    while (true) {
+        IndexNode* node = getNode(tree, node_id);
+        int idx = findKey(node, key);
+
+        if (idx < node->filled && node->keys[idx] == key) { // Key is in this node
+            if (node->children == 0) { // Node is a leaf
+                moveItems(node, idx, node, idx + 1, node->filled - (idx + 1));
+                node->filled--;
+                markNode(tree, node_id);
+                releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+                return 0;
+            }
+            // Node is internal
+            int left_id = node->child[idx];
+            int right_id = node->child[idx + 1];
+            int next_id;
+            IndexNode* left = pinNode(tree, left_id, PAGER_LATCH_EXCLUSIVE);
+            IndexNode* right = left == NULL || left->filled >= MIN ? NULL : pinNode(tree, right_id, PAGER_LATCH_EXCLUSIVE);
+            Item edge;
+            if (left == NULL) {
+                releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+                return 1;
+            } else if (left->filled >= MIN) {
+                if (getPredecessor(tree, node_id, idx, &edge) != 0) {
+                    releaseNode(tree, left_id, PAGER_LATCH_EXCLUSIVE);
+                    releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+                    return 1;
+                }
+                setItem(node, idx, edge);
+                markNode(tree, node_id);
+                key = edge.key;
+                next_id = left_id;
+            } else if (right == NULL) {
+                releaseNode(tree, left_id, PAGER_LATCH_EXCLUSIVE);
+                releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+                return 1;
+            } else if (right->filled >= MIN) {
+                if (getSuccessor(tree, node_id, idx, &edge) != 0) {
+                    releaseNode(tree, right_id, PAGER_LATCH_EXCLUSIVE);
+                    releaseNode(tree, left_id, PAGER_LATCH_EXCLUSIVE);
+                    releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+                    return 1;
+                }
+                setItem(node, idx, edge);
+                markNode(tree, node_id);
+                releaseNode(tree, left_id, PAGER_LATCH_EXCLUSIVE);
+                key = edge.key;
+                next_id = right_id;
             } else {
-                mergeNodes(node, idx);
-                deleteFromNode(node->child[idx], key);
+                mergeNodes(tree, node_id, idx);
+                releaseNode(tree, right_id, PAGER_LATCH_EXCLUSIVE);
+                next_id = left_id;
             }
+            releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+            node_id = next_id;
+            continue;
         }
-    } else { // Key is not in this node
+        // Key is not in this node
         if (node->children == 0) {
             // Key not found, should not happen if we check existence before calling
-            return;
+            releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+            return 0;
         }
 
-        bool flag = (idx == node->filled);
-        if (node->child[idx]->filled < MIN) {
-            fillNode(node, idx);
+        int child_id = node->child[idx];
+        IndexNode* child = pinNode(tree, child_id, PAGER_LATCH_EXCLUSIVE);
+        int filled_id = child == NULL || child->filled >= MIN ? child_id : fillNode(tree, node_id, idx);
+        if (child == NULL || filled_id == BTREE_NIL) {
+            if (child != NULL) {
+                releaseNode(tree, child_id, PAGER_LATCH_EXCLUSIVE);
+            }
+            releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+            return 1;
         }
-
-        if (flag && idx > node->filled)
-            deleteFromNode(node->child[idx - 1], key);
-        else
-            deleteFromNode(node->child[idx], key);
+        child_id = filled_id;
+        releaseNode(tree, node_id, PAGER_LATCH_EXCLUSIVE);
+        node_id = child_id;
     }
 }
 
 /**
  * @brief Deletes a key from the B-Tree.
- * @param root Pointer to the root of the tree.
+ * @param tree The index.
  * @param key The key to delete.
+ * @return 0 on success, 1 if a node could not be pinned; the tree then stays whole but may still hold the key,
+ * or hold it twice.
  */
-void index_delete(IndexNode** root, int64_t key) {
-    if (root == NULL || *root == NULL) {
-        return;
+int index_delete(BTree* tree, int64_t key) {
+    if (tree == NULL || tree->meta.root == BTREE_NIL) {
+        return 0;
     }
 
-    deleteFromNode(*root, key);
+    int root_id = tree->meta.root;
+    if (pinNode(tree, root_id, PAGER_LATCH_EXCLUSIVE) == NULL) {
+        return 1;
+    }
+    if (deleteFromNode(tree, root_id, key) != 0) {
+        return 1;
+    }
 
-    if ((*root)->filled == 0) {
-        IndexNode* tmp = *root;
-        if (tmp->children == 0) {
-            free(tmp);
-            *root = NULL;
-        } else {
-            *root = tmp->child[0];
-            free(tmp);
+    // A root left without keys still leads lookups to its only child, so it is replaced only now
+    IndexNode* root = pinNode(tree, root_id, PAGER_LATCH_NONE);
+    if (root == NULL) {
+        return 0; // The key is gone; an empty root is only a wasted level
+    }
+    bool empty = root->filled == 0;
+    int new_root = (root->children == 0) ? BTREE_NIL : root->child[0];
+    releaseNode(tree, root_id, PAGER_LATCH_NONE);
+    if (empty) {
+        pthread_rwlock_wrlock(&tree->latch);
+        if (pinNode(tree, root_id, PAGER_LATCH_EXCLUSIVE) != NULL) {
+            tree->meta.root = new_root;
+            storeMeta(tree);
+            freeNode(tree, root_id);
+            releaseNode(tree, root_id, PAGER_LATCH_EXCLUSIVE);
         }
+        pthread_rwlock_unlock(&tree->latch);
     }
+    return 0;
 }
 
 /**
- * @brief Frees the entire B-Tree.
- * @param root Pointer to the root of the tree.
+ * @brief Syncs the tree as the state the journal rolls back to after a crash.
+ * @param tree The index.
+ * @param lsn The owner's log position the tree is up to date with.
+ * @return 0 on success, 1 on failure.
  */
-void free_index(IndexNode** root) {
-    if (root == NULL || *root == NULL) {
-        return;
+int index_checkpoint(BTree* tree, uint64_t lsn) {
+    if (tree == NULL || tree->deleted) {
+        return 1;
     }
-    IndexNode* node = *root;
+    tree->meta.clean = 1;
+    tree->meta.checkpoint_lsn = lsn;
+    tree->needs_rebuild = false;
+    storeMeta(tree);
+    return pager_sync(tree->pager);
+}
 
-    // Recurse for all children
-    if (node->children > 0) {
-        for (int i = 0; i < node->children; i++) {
-            free_index(&(node->child[i]));
-        }
+void index_clear(BTree* tree) {
+    if (tree != NULL && !tree->deleted) {
+        clearTree(tree);
     }
+}
 
-    // Free all items in this node
-    for (int i = 0; i < node->filled; i++) {
-        free(node->values[i]);
+int index_delete_files(BTree* tree) {
+    if (tree == NULL) {
+        return 0;
     }
+    tree->deleted = true;
+    return pager_delete_files(tree->pager, tree->meta.num_pages);
+}
 
-    // Free the node itself
-    free(node);
-    *root = NULL;
+/**
+ * @brief Writes the B-Tree back to disk and frees it.
+ * @param tree The index.
+ */
+void free_index(BTree* tree) {
+    if (tree == NULL) {
+        return;
+    }
+    if (!tree->deleted) {
+        tree->meta.clean = !tree->needs_rebuild; // The header and the nodes are committed together by the journal
+        storeMeta(tree);
+        pager_sync(tree->pager);
+    }
+    free_pager(tree->pager);
+    pthread_rwlock_destroy(&tree->latch);
+    free(tree);
 }
@@ -0,0 +1,165 @@
+#include "keysearch.h"
+
+#include <stddef.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KEYSEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+// --- Window kernels: count the keys below key in a short window, without branching on the data ---
+
+static int countLessScalar(const int64_t* keys, int n, int64_t key) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        count += keys[i] < key;
+    }
+    return count;
+}
+
+#ifdef KEYSEARCH_X86
+__attribute__((target("sse4.2")))
+static int countLessSSE42(const int64_t* keys, int n, int64_t key) {
+    __m128i needle = _mm_set1_epi64x(key);
+    int count = 0;
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(keys + i));
+        __m128i less = _mm_cmpgt_epi64(needle, block);
+        count += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(less)));
+    }
+    return count + countLessScalar(keys + i, n - i, key);
+}
+
+__attribute__((target("avx2")))
+static int countLessAVX2(const int64_t* keys, int n, int64_t key) {
+    __m256i needle = _mm256_set1_epi64x(key);
+    int count = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(keys + i));
+        __m256i less = _mm256_cmpgt_epi64(needle, block);
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(less)));
+    }
+    return count + countLessScalar(keys + i, n - i, key);
+}
+
+__attribute__((target("avx512f")))
+static int countLessAVX512(const int64_t* keys, int n, int64_t key) {
+    __m512i needle = _mm512_set1_epi64(key);
+    int count = 0;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i block = _mm512_loadu_si512((const void*)(keys + i));
+        count += __builtin_popcount(_mm512_cmplt_epi64_mask(block, needle));
+    }
+    if (i < n) { // The tail is a masked load, so it never reads past the array
+        __mmask8 tail = (__mmask8)((1u << (n - i)) - 1);
+        __m512i block = _mm512_maskz_loadu_epi64(tail, (const void*)(keys + i));
+        count += __builtin_popcount(_mm512_mask_cmplt_epi64_mask(tail, block, needle));
+    }
+    return count;
+}
+#endif
+
+// --- Whole searches ---
+
+static int searchScalar(const int64_t* keys, int n, int64_t key) {
+    int i = 0;
+    while (i < n && key > keys[i]) {
+        i++;
+    }
+    return i;
+}
+
+// Halves [base, base + len) until at most window keys are left, keeping the answer inside it:
+// everything before base is < key and everything from base + len on is >= key.
+// The conditional move compiles to a cmov, so the loop has no data-dependent branch.
+static const int64_t* narrow(const int64_t* base, int* len, int64_t key, int window) {
+    while (*len > window) {
+        int half = *len / 2;
+        base = (base[half] < key) ? base + half : base;
+        *len -= half;
+    }
+    return base;
+}
+
+static int searchWindowed(int (*countLess)(const int64_t*, int, int64_t), const int64_t* keys, int n, int64_t key) {
+    int len = n;
+    const int64_t* base = narrow(keys, &len, key, KEYSEARCH_WINDOW);
+    return (int)(base - keys) + countLess(base, len, key);
+}
+
+static int searchBranchless(const int64_t* keys, int n, int64_t key) {
+    if (n == 0) {
+        return 0;
+    }
+    int len = n;
+    const int64_t* base = narrow(keys, &len, key, 1);
+    return (int)(base - keys) + (*base < key);
+}
+
+int keysearch_supported(KeySearchKernel kernel) {
+    switch (kernel) {
+        case KEYSEARCH_SCALAR:
+        case KEYSEARCH_BRANCHLESS:
+            return 1;
+#ifdef KEYSEARCH_X86
+        case KEYSEARCH_SSE42:
+            return __builtin_cpu_supports("sse4.2");
+        case KEYSEARCH_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case KEYSEARCH_AVX512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return 0;
+    }
+}
+
+static KeySearchKernel selected_kernel;
+static pthread_once_t selected_once = PTHREAD_ONCE_INIT;
+
+static void selectKernel(void) {
+    KeySearchKernel kernel = KEYSEARCH_BRANCHLESS;
+    if (keysearch_supported(KEYSEARCH_AVX512)) {
+        kernel = KEYSEARCH_AVX512;
+    } else if (keysearch_supported(KEYSEARCH_AVX2)) {
+        kernel = KEYSEARCH_AVX2;
+    } else if (keysearch_supported(KEYSEARCH_SSE42)) {
+        kernel = KEYSEARCH_SSE42;
+    }
+    selected_kernel = kernel;
+}
+
+KeySearchKernel keysearch_kernel(void) {
+    pthread_once(&selected_once, selectKernel); // Lookups on several threads may be the first to ask
+    return selected_kernel;
+}
+
+const char* keysearch_kernel_name(KeySearchKernel kernel) {
+    static const char* names[KEYSEARCH_KERNELS] = { "scalar", "branchless", "sse4.2", "avx2", "avx512" };
+    return (kernel >= 0 && kernel < KEYSEARCH_KERNELS) ? names[kernel] : "unknown";
+}
+
+int keysearch_with(KeySearchKernel kernel, const int64_t* keys, int n, int64_t key) {
+    switch (kernel) {
+#ifdef KEYSEARCH_X86
+        case KEYSEARCH_SSE42:
+            return searchWindowed(countLessSSE42, keys, n, key);
+        case KEYSEARCH_AVX2:
+            return searchWindowed(countLessAVX2, keys, n, key);
+        case KEYSEARCH_AVX512:
+            return searchWindowed(countLessAVX512, keys, n, key);
+#endif
+        case KEYSEARCH_BRANCHLESS:
+            return searchBranchless(keys, n, key);
+        default:
+            return searchScalar(keys, n, key);
+    }
+}
+
+int keysearch(const int64_t* keys, int n, int64_t key) {
+    return keysearch_with(keysearch_kernel(), keys, n, key);
+}
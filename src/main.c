@@ -1,25 +1,308 @@
 #include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include "table.h"
 #include "util.h"
 
+#define LOAD_BATCH_ROWS (NUM_ROWS_PAGE * 1024) // Records per table_insert_batch call of --load; whole pages, so only the last batch leaves one part empty
 
 void clear_input_buffer() {
     int c;
     while ((c = getchar()) != '\n' && c != EOF);
 }
 
-int main() {
-    Table* table = create_table();
+// Prints one row of a range scan
+static int print_row(const Row* row, RowLoc pos, void* arg) {
+    (void)arg;
+    printf("Page: %d, Row: %d, ID: %" PRId64 ", Name: %s, Email: %s\n", pos.page_slot, pos.row_slot, row->id, row->name, row->email);
+    return 0;
+}
+
+// Prints the row at pos, keeping its page pinned while reading it
+static void print_row_at(Table* table, RowLoc pos) {
+    const Page* page = table_pin_page(table, pos.page_slot);
+    if (page == NULL) {
+        print_red("Failed to read page!\n");
+        return;
+    }
+    if (page_row_exists(page, pos.row_slot)) {
+        const Row* row = &page->rows[pos.row_slot];
+        printf("ID: %" PRId64 ", Name: %s, Email: %s\n", row->id, row->name, row->email);
+    }
+    table_unpin_page(table, pos.page_slot);
+}
+
+// Parses a positive decimal count, returns 0 on success, 1 on failure
+static int parse_count(const char* text, size_t* out) {
+    if (text == NULL || *text == '\0') {
+        return 1;
+    }
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (*end != '\0' || value == 0 || text[0] == '-' || errno == ERANGE || value > SIZE_MAX) {
+        return 1;
+    }
+    *out = (size_t)value;
+    return 0;
+}
+
+// Parses a positive count of MiB into bytes, returns 0 on success, 1 on failure or if the bytes do not fit a size_t
+static int parse_megabytes(const char* text, size_t* bytes) {
+    size_t value;
+    if (parse_count(text, &value) != 0 || value > SIZE_MAX >> 20) {
+        return 1;
+    }
+    *bytes = value << 20;
+    return 0;
+}
+
+// Bulk loads a file of "id,name,email" lines with table_insert_batch, LOAD_BATCH_ROWS records at a time. A batch
+// that fails, e.g. on an ID already in the table, inserts none of its records and stops the load.
+// Returns 0 on success, 1 on failure.
+static int load_records(Table* table, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Failed to open %s!\n", path);
+        return 1;
+    }
+    Row* rows = malloc(LOAD_BATCH_ROWS * sizeof(Row));
+    if (rows == NULL) {
+        printf("Memory allocation for loading failed!\n");
+        fclose(file);
+        return 1;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char line[32 + MAX_NAME_SIZE + MAX_EMAIL_SIZE];
+    size_t line_no = 0, count = 0, loaded = 0;
+    int ret = 0;
+    while (ret == 0 && fgets(line, sizeof(line), file) != NULL) {
+        line_no++;
+        if (strchr(line, '\n') == NULL && !feof(file)) {
+            printf("Line %zu of %s is too long!\n", line_no, path);
+            ret = 1;
+            break;
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        char* name = strchr(line, ',');
+        char* email = name != NULL ? strchr(name + 1, ',') : NULL;
+        char* id_end = line;
+        int64_t id = strtoll(line, &id_end, 10);
+        if (email == NULL || id_end != name || id < 0 || email - name > MAX_NAME_SIZE || strlen(email + 1) >= MAX_EMAIL_SIZE) {
+            printf("Line %zu of %s is not a valid id,name,email record!\n", line_no, path);
+            ret = 1;
+            break;
+        }
+        *email = '\0';
+        Row* row = &rows[count];
+        memset(row, 0, sizeof(Row));
+        row->id = id;
+        strcpy(row->name, name + 1);
+        strcpy(row->email, email + 1);
+        if (++count == LOAD_BATCH_ROWS) {
+            ret = table_insert_batch(table, rows, count);
+            loaded += ret == 0 ? count : 0;
+            count = 0;
+        }
+    }
+    if (ret == 0 && count > 0) {
+        ret = table_insert_batch(table, rows, count);
+        loaded += ret == 0 ? count : 0;
+    }
+    free(rows);
+    fclose(file);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Loaded %zu records from %s in %.2f s (%.0f records/s)\n", loaded, path, secs, secs > 0 ? loaded / secs : 0.0);
+    if (ret != 0) {
+        printf("Loading stopped at line %zu; the records of the batch it ends were not inserted\n", line_no);
+    }
+    return ret;
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [--cache-pages N | --cache-mb N] [--cache-policy lru|2q] [--storage single|files] [--mmap] [--flush-clean N | --no-flusher] [--commit-delay-us N]\n"
+           "       [--readahead N | --no-readahead] [--io-uring] [--checkpoint-mb N] [--checkpoint-secs N] [--load FILE]\n", prog);
+    printf("  --cache-pages N  Keep up to N pages in the buffer pool (env BYOD_CACHE_PAGES)\n");
+    printf("  --cache-mb N     Size the buffer pool to an N MiB budget (env BYOD_CACHE_MB)\n");
+    printf("  --cache-policy P Evict the least recently used page (lru, default) or resist scans with 2Q (2q)\n");
+    printf("  --storage single Keep all pages in data/pages.db, converting old page files (default)\n");
+    printf("  --storage files  Keep one data/page_<id>.bin file per page\n");
+    printf("  --mmap           Serve pages straight from a memory mapping of data/pages.db\n");
+    printf("  --flush-clean N  Have a background thread keep the N least recently used pages written back (default %d)\n", PAGER_FLUSH_CLEAN);
+    printf("  --no-flusher     Write dirty pages back only when they are evicted\n");
+    printf("  --readahead N    Prefetch N pages ahead of sequential reads in the background (default %d)\n", PAGER_READAHEAD_PAGES);
+    printf("  --no-readahead   Read pages only when they are asked for\n");
+    printf("  --io-uring       Batch page reads and writes through io_uring where the kernel allows it\n");
+    printf("  --direct-io      Read and write data/pages.db with O_DIRECT, caching pages only in the buffer pool\n");
+    printf("  --hugepages      Map the buffer pool's page frames with huge pages where the system allows it\n");
+    printf("  --commit-delay-us N  Have each log commit wait N microseconds for others to share its sync (default 0)\n");
+    printf("  --checkpoint-mb N    Checkpoint once the log reaches N MiB, 0 never (default %d)\n", WAL_CHECKPOINT_BYTES >> 20);
+    printf("  --checkpoint-secs N  Checkpoint once N seconds passed since the last one, 0 never (default %d)\n", WAL_CHECKPOINT_INTERVAL_MS / 1000);
+    printf("  --load FILE      Bulk load the id,name,email lines of FILE in batches before the menu opens\n");
+}
+
+// Builds the pager and log configurations from the environment, then the command line, which takes precedence.
+// Sets *load_path to the --load file, NULL without one. Returns 0 on success, 1 on invalid arguments.
+static int parse_config(int argc, char* argv[], PagerConfig* config, WalConfig* wal_config, const char** load_path) {
+    *config = pager_default_config();
+    *wal_config = wal_default_config();
+    *load_path = NULL;
+    size_t value;
+
+    const char* env = getenv("BYOD_CACHE_MB");
+    if (env != NULL) {
+        if (parse_megabytes(env, &value) != 0) {
+            printf("Invalid BYOD_CACHE_MB: %s\n", env);
+            return 1;
+        }
+        config->cache_pages = 0;
+        config->cache_bytes = value;
+    }
+    env = getenv("BYOD_CACHE_PAGES");
+    if (env != NULL) {
+        if (parse_count(env, &value) != 0) {
+            printf("Invalid BYOD_CACHE_PAGES: %s\n", env);
+            return 1;
+        }
+        config->cache_pages = value;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cache-pages") == 0 && i + 1 < argc && parse_count(argv[i + 1], &value) == 0) {
+            config->cache_pages = value;
+            i++;
+        } else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc && parse_megabytes(argv[i + 1], &value) == 0) {
+            config->cache_pages = 0;
+            config->cache_bytes = value;
+            i++;
+        } else if (strcmp(argv[i], "--storage") == 0 && i + 1 < argc && strcmp(argv[i + 1], "single") == 0) {
+            config->storage = PAGER_STORAGE_SINGLE_FILE;
+            i++;
+        } else if (strcmp(argv[i], "--storage") == 0 && i + 1 < argc && strcmp(argv[i + 1], "files") == 0) {
+            config->storage = PAGER_STORAGE_PAGE_FILES;
+            i++;
+        } else if (strcmp(argv[i], "--cache-policy") == 0 && i + 1 < argc && strcmp(argv[i + 1], "lru") == 0) {
+            config->policy = PAGER_POLICY_LRU;
+            i++;
+        } else if (strcmp(argv[i], "--cache-policy") == 0 && i + 1 < argc && strcmp(argv[i + 1], "2q") == 0) {
+            config->policy = PAGER_POLICY_2Q;
+            i++;
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            config->mode = PAGER_MODE_MMAP;
+        } else if (strcmp(argv[i], "--flush-clean") == 0 && i + 1 < argc && parse_count(argv[i + 1], &value) == 0) {
+            config->flush_clean_pages = value;
+            i++;
+        } else if (strcmp(argv[i], "--readahead") == 0 && i + 1 < argc && parse_count(argv[i + 1], &value) == 0) {
+            config->readahead_pages = value;
+            i++;
+        } else if (strcmp(argv[i], "--no-readahead") == 0) {
+            config->readahead_pages = 0;
+        } else if (strcmp(argv[i], "--io-uring") == 0) {
+            config->io_uring = true;
+        } else if (strcmp(argv[i], "--direct-io") == 0) {
+            config->direct_io = true;
+        } else if (strcmp(argv[i], "--hugepages") == 0) {
+            config->hugepages = true;
+        } else if (strcmp(argv[i], "--no-flusher") == 0) {
+            config->flush_clean_pages = 0;
+        } else if (strcmp(argv[i], "--commit-delay-us") == 0 && i + 1 < argc && parse_count(argv[i + 1], &value) == 0 && value <= UINT32_MAX) {
+            wal_config->commit_delay_us = value;
+            i++;
+        } else if (strcmp(argv[i], "--checkpoint-mb") == 0 && i + 1 < argc && parse_megabytes(argv[i + 1], &value) == 0) {
+            wal_config->checkpoint_bytes = value;
+            i++;
+        } else if (strcmp(argv[i], "--checkpoint-secs") == 0 && i + 1 < argc && parse_count(argv[i + 1], &value) == 0 && value <= UINT32_MAX / 1000) {
+            wal_config->checkpoint_interval_ms = value * 1000;
+            i++;
+        } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            *load_path = argv[i + 1];
+            i++;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void print_pager_stats(Pager* pager) {
+    PagerStats stats;
+    pager_get_stats(pager, &stats);
+    printf("Cached pages: %zu/%zu\n", stats.cached_pages, stats.capacity_pages);
+    printf("Bytes in use: %zu (peak %zu)\n", stats.bytes_in_use, stats.peak_bytes);
+    if (stats.frame_slots > 0) {
+        printf("Page frames: %zu reserved at start, %zu used so far, mapped with %s", stats.frame_slots, stats.frames_used, stats.frame_backing);
+        if (stats.heap_nodes > 0) {
+            printf(", %zu more taken from the heap while all were in use", stats.heap_nodes);
+        }
+        printf("\n");
+    }
+    printf("Pages written back: %zu, clean writes avoided: %zu\n", stats.pages_written, stats.writes_avoided);
+    printf("Evictions that had to write: %zu\n", stats.eviction_writes);
+    size_t requests = stats.cache_hits + stats.cache_misses;
+    if (requests > 0) {
+        printf("%s hit ratio: %.1f%% (%zu hits, %zu misses", stats.policy, 100.0 * stats.cache_hits / requests, stats.cache_hits, stats.cache_misses);
+        if (stats.ghost_hits > 0) {
+            printf(", %zu of them on pages evicted lately", stats.ghost_hits);
+        }
+        printf(")\n");
+    }
+    if (stats.pages_flushed > 0 || stats.flush_queue_depth > 0) {
+        printf("Flusher: %zu pages written, %zu queued, %.1f us average, %.1f us max\n",
+               stats.pages_flushed, stats.flush_queue_depth, stats.flush_avg_us, stats.flush_max_us);
+    }
+    if (stats.readahead_windows > 0) {
+        printf("Read-ahead: %zu windows, %zu pages\n", stats.readahead_windows, stats.readahead_pages);
+    }
+    if (stats.direct_io) {
+        printf("Data file read and written with O_DIRECT\n");
+    }
+    if (stats.ring_submits > 0) {
+        printf("io_uring: %zu page operations in %zu system calls\n", stats.ring_ops, stats.ring_submits);
+    }
+    if (stats.checkpoint_pending > 0) {
+        printf("Checkpoint pages still to write: %zu\n", stats.checkpoint_pending);
+    }
+    if (stats.mapped_bytes > 0) {
+        printf("Mapped bytes: %zu\n", stats.mapped_bytes);
+    }
+}
+
+static void print_wal_stats(Wal* wal) {
+    WalStats stats;
+    wal_get_stats(wal, &stats);
+    printf("Log: %" PRIu64 " records, %" PRIu64 " bytes appended, %" PRIu64 " bytes on disk\n", stats.records, stats.bytes, stats.log_bytes);
+    printf("Log commits: %" PRIu64 " in %" PRIu64 " syncs, durable up to LSN %" PRIu64 "\n", stats.commits, stats.syncs, stats.durable_lsn);
+    printf("Checkpoints: %" PRIu64 "\n", stats.truncations);
+}
+
+int main(int argc, char* argv[]) {
+    PagerConfig config;
+    WalConfig wal_config;
+    const char* load_path;
+    if (parse_config(argc, argv, &config, &wal_config, &load_path) != 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    Table* table = create_table(&config, &wal_config);
 
     if (!table) {
         printf("Failed to create table!\n");
         return 1;
     }
+    if (load_path != NULL && load_records(table, load_path) != 0) {
+        print_red("Failed to load records!\n");
+    }
 
     int service;
     int64_t id;
@@ -41,6 +324,8 @@ int main() {
         print_cyan("8. Print All Records\n");
         print_cyan("9. Exit\n");
         print_cyan("10.Delete database files and exit\n");
+        print_cyan("11.Show cache statistics\n");
+        print_cyan("12.Print Records in an ID range\n");
         print_yellow("Enter your choice: ");
         
         if (scanf("%d", &service) != 1) {
@@ -77,9 +362,7 @@ int main() {
 
                 if (table_find_id(table, id, &pos) == 0) {
                     printf("Record found at Page: %d, Row: %d\n", pos.page_slot, pos.row_slot);
-                    Page* page = table_get_page(table, pos.page_slot);
-                    Row* row = &page->rows[pos.row_slot]; 
-                    printf("ID: %" PRId64 ", Name: %s, Email: %s\n", row->id, row->name, row->email);
+                    print_row_at(table, pos);
                 } else {
                     print_red("Failed to find record!\n");
                 }
@@ -91,9 +374,7 @@ int main() {
 
                 if (table_find_name(table, name, &pos) == 0) {
                     printf("Record found at Page: %d, Row: %d\n", pos.page_slot, pos.row_slot);
-                    Page* page = table_get_page(table, pos.page_slot);
-                    Row* row = &page->rows[pos.row_slot]; 
-                    printf("ID: %" PRId64 ", Name: %s, Email: %s\n", row->id, row->name, row->email);
+                    print_row_at(table, pos);
                 } else {
                     print_red("Failed to find record!\n");
                 }
@@ -105,17 +386,17 @@ int main() {
 
                 if (table_find_id(table, id, &pos) == 0) {
                     printf("Record found at Page: %d, Row: %d\n", pos.page_slot, pos.row_slot);
-                    Page* page = table_get_page(table, pos.page_slot);
-                    Row* row = &page->rows[pos.row_slot]; 
 
                     print_yellow("Enter Name: ");
-                    fgets(row->name, MAX_NAME_SIZE, stdin);
-                    row->name[strcspn(row->name, "\n")] = '\0'; // Remove trailing newline
+                    fgets(name, MAX_NAME_SIZE, stdin);
+                    name[strcspn(name, "\n")] = '\0'; // Remove trailing newline
 
                     print_yellow("Enter Email: ");
-                    fgets(row->email, MAX_EMAIL_SIZE, stdin);
-                    row->email[strcspn(row->email, "\n")] = '\0';
-
+                    fgets(email, MAX_EMAIL_SIZE, stdin);
+                    email[strcspn(email, "\n")] = '\0';
+                    if (table_update_row(table, pos, name, email) != 0) {
+                        print_red("Failed to update record!\n");
+                    }
                 } else {
                     print_red("Failed to update record!\n");
                 }
@@ -127,17 +408,17 @@ int main() {
 
                 if (table_find_name(table, name, &pos) == 0) {
                     printf("Record found at Page: %d, Row: %d\n", pos.page_slot, pos.row_slot);
-                    Page* page = table_get_page(table, pos.page_slot);
-                    Row* row = &page->rows[pos.row_slot]; 
 
                     print_yellow("Enter Name: ");
-                    fgets(row->name, MAX_NAME_SIZE, stdin);
-                    row->name[strcspn(row->name, "\n")] = '\0'; // Remove trailing newline
+                    fgets(name, MAX_NAME_SIZE, stdin);
+                    name[strcspn(name, "\n")] = '\0'; // Remove trailing newline
 
                     print_yellow("Enter Email: ");
-                    fgets(row->email, MAX_EMAIL_SIZE, stdin);
-                    row->email[strcspn(row->email, "\n")] = '\0';
-
+                    fgets(email, MAX_EMAIL_SIZE, stdin);
+                    email[strcspn(email, "\n")] = '\0';
+                    if (table_update_row(table, pos, name, email) != 0) {
+                        print_red("Failed to update record!\n");
+                    }
                 } else {
                     print_red("Failed to update record!\n");
                 }
@@ -175,26 +456,33 @@ int main() {
             case 10:
                 print_magenta("Thank you for using Group 2 Database!\n");
                 print_yellow("Deleting database files...\n");
-                // Clear the pager's data directory
-                if (table->pager && table->pager->data_dir) {
-                    char filepath[512];
-                    int deleted_count = 0;
-                        for (int i = 0; i < (int)table->num_pages; ++i) {
-                        // Construct the full file path
-                        snprintf(filepath, sizeof(filepath), "%s/page_%d.bin", table->pager->data_dir, i);
-                        printf("Attempting to delete: %s\n", filepath);
-                        if (remove(filepath) == 0) {
-                        printf("Successfully deleted: %s\n", filepath);
-                        deleted_count++;
-                        } else {
-                            printf("Could not delete: %s\n", filepath);
-                        }
-                    }
-                    printf("Deleted %d database files.\n", deleted_count);
-                }
+                printf("Deleted %d database files.\n", table_delete_files(table));
                 print_magenta("Database files cleared successfully!\n");
                 free_table(table); 
                 return 0;
+            case 11:
+                print_magenta("CACHE STATISTICS:\n");
+                print_magenta("Table pages:\n");
+                print_pager_stats(table->pager);
+                if (table->index != NULL) {
+                    print_magenta("Index pages:\n");
+                    print_pager_stats(table->index->pager);
+                }
+                print_wal_stats(table->wal);
+                break;
+            case 12: {
+                int64_t hi;
+                print_yellow("Enter lowest ID: ");
+                scanf("%" SCNd64, &id);
+                clear_input_buffer();
+                print_yellow("Enter highest ID: ");
+                scanf("%" SCNd64, &hi);
+                clear_input_buffer();
+
+                size_t found = table_scan_range(table, id, hi, print_row, NULL);
+                printf("%zu records found.\n", found);
+                break;
+            }
             default:
                 print_red("Invalid choice! Please try again.\n");
                 break;
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nameindex.h"
+
+static uint64_t hash_name(const char* name) { // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char* c = (const unsigned char*)name; *c != '\0'; c++) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int entry_matches(const NameEntry* entry, uint64_t hash, const char* name) {
+    return entry->hash == hash && strcmp(entry->name, name) == 0;
+}
+
+static int loc_before(RowLoc a, RowLoc b) {
+    return a.page_slot < b.page_slot || (a.page_slot == b.page_slot && a.row_slot < b.row_slot);
+}
+
+NameIndex* create_name_index(void) {
+    NameIndex* index = malloc(sizeof(NameIndex));
+    if (index == NULL) {
+        printf("Error: Memory allocation failed for name index\n");
+        return NULL;
+    }
+    index->num_buckets = NAME_INDEX_MIN_BUCKETS;
+    index->count = 0;
+    index->buckets = calloc(index->num_buckets, sizeof(NameEntry*));
+    if (index->buckets == NULL) {
+        printf("Error: Memory allocation failed for name index\n");
+        free(index);
+        return NULL;
+    }
+    return index;
+}
+
+void free_name_index(NameIndex* index) {
+    if (index == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < index->num_buckets; i++) {
+        NameEntry* entry = index->buckets[i];
+        while (entry != NULL) {
+            NameEntry* next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+    free(index->buckets);
+    free(index);
+}
+
+// Doubles the bucket array and rehashes every entry; on allocation failure the index keeps its old size
+static void grow(NameIndex* index) {
+    size_t num_buckets = index->num_buckets * 2;
+    NameEntry** buckets = calloc(num_buckets, sizeof(NameEntry*));
+    if (buckets == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < index->num_buckets; i++) {
+        NameEntry* entry = index->buckets[i];
+        while (entry != NULL) {
+            NameEntry* next = entry->next;
+            size_t b = entry->hash & (num_buckets - 1);
+            entry->next = buckets[b];
+            buckets[b] = entry;
+            entry = next;
+        }
+    }
+    free(index->buckets);
+    index->buckets = buckets;
+    index->num_buckets = num_buckets;
+}
+
+int name_index_insert(NameIndex* index, const char* name, RowLoc pos) {
+    NameEntry* entry = malloc(sizeof(NameEntry));
+    if (entry == NULL) {
+        printf("Error: Memory allocation failed for name index entry\n");
+        return 1;
+    }
+    entry->hash = hash_name(name);
+    strncpy(entry->name, name, MAX_NAME_SIZE);
+    entry->name[MAX_NAME_SIZE - 1] = '\0';
+    entry->pos = pos;
+    if (index->count >= index->num_buckets) {
+        grow(index);
+    }
+    size_t b = entry->hash & (index->num_buckets - 1);
+    entry->next = index->buckets[b];
+    index->buckets[b] = entry;
+    index->count++;
+    return 0;
+}
+
+int name_index_delete(NameIndex* index, const char* name, RowLoc pos) {
+    uint64_t hash = hash_name(name);
+    NameEntry** link = &index->buckets[hash & (index->num_buckets - 1)];
+    while (*link != NULL) {
+        NameEntry* entry = *link;
+        if (entry_matches(entry, hash, name) && entry->pos.page_slot == pos.page_slot && entry->pos.row_slot == pos.row_slot) {
+            *link = entry->next;
+            free(entry);
+            index->count--;
+            return 0;
+        }
+        link = &entry->next;
+    }
+    return 1;
+}
+
+int name_index_find(const NameIndex* index, const char* name, RowLoc* pos) {
+    uint64_t hash = hash_name(name);
+    int found = 0;
+    // Of several rows with the name, report the one a page-by-page scan would meet first
+    for (NameEntry* entry = index->buckets[hash & (index->num_buckets - 1)]; entry != NULL; entry = entry->next) {
+        if (entry_matches(entry, hash, name) && (!found || loc_before(entry->pos, *pos))) {
+            *pos = entry->pos;
+            found = 1;
+        }
+    }
+    return found ? 0 : 1;
+}
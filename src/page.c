@@ -4,10 +4,58 @@
 
 #include "page.h"
 
-// Note that the row find loops run for NUM_ROWS_PAGE, as the page is fixed size
+// Slot occupancy is a bitmap in the header: free and occupied slots are found a 64-bit word at a time with
+// count-trailing-zeros, so the find loops only visit slots that hold rows.
+
+// Header of the first builds' pages, which kept one byte per slot and had no free-page list. Its first byte is
+// row_exists[0], so 0 or 1, never a PAGE_LAYOUT_* value.
+typedef struct {
+    uint8_t row_exists[NUM_ROWS_PAGE];
+    size_t num_rows;
+    int page_id;
+} LegacyHeader;
+
+typedef struct {
+    LegacyHeader header;
+    Row rows[NUM_ROWS_PAGE];
+} LegacyPage;
+
+_Static_assert(offsetof(LegacyPage, rows) == 40, "Legacy rows start at byte 40");
+_Static_assert(sizeof(LegacyPage) <= PAGE_SIZE, "Legacy page must fit in PAGE_SIZE");
+
+// Header of PAGE_LAYOUT_BITMAP pages, the same size as Header but with a wider num_rows and no LSN
+typedef struct {
+    uint8_t layout;
+    uint8_t in_free_list;
+    int32_t page_id;
+    int32_t next_free;
+    size_t num_rows;
+    uint64_t slot_bits[PAGE_SLOT_WORDS];
+} BitmapHeader;
+
+_Static_assert(sizeof(BitmapHeader) == sizeof(Header), "Bitmap pages keep their rows in place");
+
+static uint32_t count_rows(const Page* page) {
+    uint32_t count = 0;
+    for(size_t w = 0; w < PAGE_SLOT_WORDS; w++){
+        count += __builtin_popcountll(page->header.slot_bits[w]);
+    }
+    return count;
+}
+
+// Mask of the slots of word w that exist in a page
+static uint64_t slot_mask(size_t w) {
+    size_t slots = NUM_ROWS_PAGE - w * 64;
+    return slots >= 64 ? ~0ULL : (1ULL << slots) - 1;
+}
 
 Page* create_page(){
-    Page* page = calloc(1, sizeof(Page));
+    // Full PAGE_SIZE and aligned to it, so pages can be written to disk as whole blocks, also with O_DIRECT
+    void* page = NULL;
+    if(posix_memalign(&page, PAGE_SIZE, PAGE_SIZE) != 0){
+        return NULL;
+    }
+    memset(page, 0, PAGE_SIZE);
     return page;
 }
 
@@ -17,9 +65,57 @@ void free_page(Page* page){
     }    
 }
 
-int page_find_row_id(Page* page, int64_t id) {
+bool page_upgrade(Page* page) {
+    if(page->header.layout == PAGE_LAYOUT_LSN){
+        return false;
+    }
+    if(page->header.layout == PAGE_LAYOUT_BITMAP){
+        BitmapHeader old;
+        memcpy(&old, page, sizeof(BitmapHeader));
+        memset(&page->header, 0, sizeof(Header));
+        page->header.layout = PAGE_LAYOUT_LSN;
+        page->header.in_free_list = old.in_free_list;
+        page->header.page_id = old.page_id;
+        page->header.next_free = old.next_free;
+        memcpy(page->header.slot_bits, old.slot_bits, sizeof(old.slot_bits));
+        page->header.num_rows = count_rows(page);
+        return true;
+    }
+    // A legacy page. Its header was larger, so the rows move down to where the new header ends; it is in no
+    // free-page list yet, the table links it in when it scans the upgraded pages.
+    LegacyHeader old;
+    memcpy(&old, page, sizeof(LegacyHeader));
+    memmove(page->rows, ((LegacyPage*)page)->rows, sizeof(page->rows));
+    memset(&page->header, 0, sizeof(Header));
+    page->header.layout = PAGE_LAYOUT_LSN;
+    page->header.in_free_list = 0;
+    page->header.page_id = old.page_id;
+    page->header.next_free = PAGE_NO_NEXT;
     for(size_t i = 0; i < NUM_ROWS_PAGE; i++){
-        if(page->rows[i].id == id && page->header.row_exists[i]){
+        if(old.row_exists[i]){
+            page->header.slot_bits[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+    page->header.num_rows = count_rows(page);
+    return true;
+}
+
+int page_next_row(const Page* page, size_t slot) {
+    for(size_t w = slot / 64; w < PAGE_SLOT_WORDS; w++){
+        uint64_t bits = page->header.slot_bits[w] & slot_mask(w);
+        if(w == slot / 64){
+            bits &= ~0ULL << (slot % 64); // Drop the slots before the start
+        }
+        if(bits){
+            return w * 64 + __builtin_ctzll(bits);
+        }
+    }
+    return -1;
+}
+
+int page_find_row_id(Page* page, int64_t id) {
+    for(int i = page_next_row(page, 0); i >= 0; i = page_next_row(page, i + 1)){
+        if(page->rows[i].id == id){
             return i;
         }
     }
@@ -27,8 +123,8 @@ int page_find_row_id(Page* page, int64_t id) {
 }
 
 int page_find_row_name(Page* page, const char* name) {
-    for(size_t i = 0; i < NUM_ROWS_PAGE; i++){
-        if(strcmp(page->rows[i].name, name) == 0 && page->header.row_exists[i]){
+    for(int i = page_next_row(page, 0); i >= 0; i = page_next_row(page, i + 1)){
+        if(strcmp(page->rows[i].name, name) == 0){
             return i;
         }
     }
@@ -39,26 +135,39 @@ int page_find_row_name(Page* page, const char* name) {
 int page_insert_row(Page* page, const Row* row){
     if(page->header.num_rows == NUM_ROWS_PAGE){
         printf("Insufficient space in page\n");
-        return 1;
+        return -1;
     }
-    int empty_ind = 0;
-    for(size_t i = 0; i < NUM_ROWS_PAGE; i++){
-        if(!page->header.row_exists[i]){
-            empty_ind = i;
-            break;
+    for(size_t w = 0; w < PAGE_SLOT_WORDS; w++){
+        uint64_t free_bits = ~page->header.slot_bits[w] & slot_mask(w);
+        if(free_bits){
+            size_t slot = w * 64 + __builtin_ctzll(free_bits);
+            page->rows[slot] = *row;
+            page->header.slot_bits[w] |= 1ULL << (slot % 64);
+            page->header.num_rows++;
+            return slot;
         }
     }
-    page->rows[empty_ind] = *row;
-    page->header.row_exists[empty_ind] = 1;
-    page->header.num_rows++;
+    printf("Insufficient space in page\n");
+    return -1;
+}
+
+int page_put_row(Page* page, size_t slot_index, const Row* row) {
+    if(slot_index >= NUM_ROWS_PAGE){
+        return 1;
+    }
+    if(!page_row_exists(page, slot_index)){
+        page->header.slot_bits[slot_index / 64] |= 1ULL << (slot_index % 64);
+        page->header.num_rows++;
+    }
+    page->rows[slot_index] = *row;
     return 0;
 }
 
 int page_delete_row(Page* page, size_t slot_index) {
-    if(slot_index >= page->header.num_rows || !page->header.row_exists[slot_index]){
+    if(!page_row_exists(page, slot_index)){
         return 1;
     }
-    page->header.row_exists[slot_index] = 0;
+    page->header.slot_bits[slot_index / 64] &= ~(1ULL << (slot_index % 64));
     page->header.num_rows--;
     return 0;
-}
\ No newline at end of file
+}
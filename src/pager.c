@@ -1,295 +1,2208 @@
+#define _GNU_SOURCE // For fallocate and O_DIRECT
 #include "pager.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h> // For strncpy
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <inttypes.h>
+
+#ifdef PAGER_TRACE
+#define pager_trace(...) printf(__VA_ARGS__)
+#else
+#define pager_trace(...) ((void)0) // Per-access cache logging is compiled out unless built with PAGER_TRACE
+#endif
 
 // Double Linked List Node Structure
 // This structure is used to implement the LRU Cache.
 // Each node in the linked list holds a pointer to a Page and links to prev/next nodes.
 typedef struct DLLNode {
+    int page_id; // Cache key; the pager never looks inside the page, so any PAGE_SIZE block can be cached
     Page* page; // Pointer to the actual Page data
     struct DLLNode *prev;
     struct DLLNode *next;
+    struct DLLNode *hnext; // Next node in the same hash bucket
+    bool dirty; // Page differs from its on-disk copy and must be written back before it is dropped
+    uint64_t version; // Pager.dirty_seq when it last became dirty, so the flusher can tell if it changed during a write
+    bool checkpoint; // Was dirty when the running checkpoint began, and has not been written since
+    int pins; // pager_pin calls not yet unpinned; a pinned page is never evicted or written by the flusher
+    pthread_rwlock_t latch; // Held shared by readers of the page and exclusively by its writer, see pager_pin
+    int queue; // Replacement policy queue holding the node
+    bool from_heap; // Allocated on its own because every frame of the arena was taken, see create_frames
 } DLLNode;
 
-// LRU Cache (implemented without hashmaps for lookups)
+#define CACHE_QUEUES 2 // Queues a replacement policy can spread the cached pages over
+
+// Page ids a policy remembers after their pages left the cache (2Q's A1out), oldest forgotten first.
+// A ring of ids with a hash table over the ring slots, so a miss can ask whether its page was seen lately.
+typedef struct {
+    int* ids;      // Ring of page ids, -1 for a slot whose id was taken back out
+    int* next;     // Next slot in the same hash bucket, -1 ends the chain
+    int* buckets;  // First slot of each bucket, -1 if empty
+    size_t num_buckets; // Power of two
+    size_t capacity;
+    size_t count;  // Slots in use
+    size_t oldest; // Slot overwritten next once the ring is full
+} GhostList;
+
+struct LRUCache;
+
+// Replacement policy. Each queue is a doubly linked list from its most recently used head to its tail,
+// and the policy decides which queue a page enters and moves to, and which queue's tail is evicted first.
+typedef struct {
+    const char* name;
+    void (*admit)(struct LRUCache* cache, DLLNode* node); // A page entering the cache
+    void (*hit)(struct LRUCache* cache, DLLNode* node); // A cached page used again
+    void (*evicted)(struct LRUCache* cache, DLLNode* node); // A page about to be evicted, still in its queue
+    int (*victim_queue)(const struct LRUCache* cache); // Queue whose tail is evicted first; the other one follows
+} CachePolicy;
+
+// Page cache
+// The policy's queues keep the replacement order, and a page_id -> node hash table (separate chaining
+// through DLLNode.hnext) finds a node without walking them, so get, put and eviction are all O(1).
 typedef struct LRUCache {
-    int capacity;
-    int current_size;
-    DLLNode* head;  // Most recently used (MRU) end
-    DLLNode* tail;  // Least recently used (LRU) end
+    size_t capacity;
+    size_t current_size;
+    const CachePolicy* policy;
+    DLLNode* head[CACHE_QUEUES]; // Most recently used (MRU) end of each queue
+    DLLNode* tail[CACHE_QUEUES]; // Least recently used (LRU) end of each queue
+    size_t queue_size[CACHE_QUEUES];
+    GhostList ghosts; // Only allocated for PAGER_POLICY_2Q
+    size_t hits;
+    size_t misses;
+    size_t ghost_hits; // Misses on pages the policy still remembered
+    DLLNode** buckets; // Hash table of nodes keyed by page_id
+    size_t num_buckets; // Always a power of two, so the bucket index is a mask
+    size_t bytes_in_use; // Pages, nodes and hash table currently allocated
+    size_t peak_bytes; // High-water mark of bytes_in_use
+    size_t pages_written; // Dirty pages written back on eviction or shutdown
+    size_t writes_avoided; // Clean pages dropped without a write
+    size_t eviction_writes; // Dirty pages written on the request path by an eviction
+    size_t pages_flushed; // Pages written by the flusher thread
+    uint64_t flush_ns_total;
+    uint64_t flush_ns_max;
+    // Frame arena, see create_frames
+    DLLNode* slots; // num_slots nodes, slot i owning frame i for good
+    size_t num_slots;
+    size_t slots_used; // Slots set up so far; the ones past it have never been handed out
+    char* frames; // One mapping of frames_bytes, PAGE_SIZE-aligned
+    size_t frames_bytes;
+    DLLNode* free_slots; // Slots not caching a page, linked through DLLNode.next
+    const char* frame_backing; // Kind of memory page the frames are mapped with
+    size_t heap_nodes; // Nodes allocated from the heap so far
 } LRUCache;
 
-int save_page(Page* page, const char* data_dir) {
+int save_page(int page_id, Page* page, const char* data_dir) {
     if (page == NULL || data_dir == NULL) {
         printf("Invalid arguments to save_page!\n");
         return 1;
     }
 
     char filename[256];
-    snprintf(filename, sizeof(filename), "%s/page_%d.bin", data_dir, page->header.page_id);
+    snprintf(filename, sizeof(filename), "%s/page_%d.bin", data_dir, page_id);
 
-    FILE* file = fopen(filename, "wb");
-    if (file == NULL) {
+    // Overwritten in place and synced, not truncated first: a crash must not leave an empty file behind a
+    // checkpoint that counts the page as written
+    int fd = open(filename, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) {
         printf("Failed to open file for saving page!\n");
         return 1;
     }
 
-    size_t written = fwrite(page, sizeof(Page), 1, file);
-    fclose(file);
+    ssize_t written = pwrite(fd, page, sizeof(Page), 0);
+    int synced = fdatasync(fd);
+    close(fd);
 
-    if (written != 1) {
+    if (written != (ssize_t)sizeof(Page) || synced != 0) {
         printf("Failed to write page to file!\n");
         return 1;
     }
     return 0;
 }
 
-Page* load_page(int page_id, const char* data_dir) {
-    if (data_dir == NULL) {
-        printf("Invalid data directory!\n");
-        return NULL;
-    }
-
+// Reads the page file of page_id into page. Returns 1 if there is none or it cannot be read.
+static int read_page_file(int page_id, const char* data_dir, Page* page) {
     char filename[256];
     snprintf(filename, sizeof(filename), "%s/page_%d.bin", data_dir, page_id);
 
     FILE* file = fopen(filename, "rb");
     if (file == NULL) {
-        //printf("Failed to open file for loading page!\n");
-        // not printing this, as it is expected that the page may not exist, and are created if it doesn't
+        return 1; // Expected for pages that were never written
+    }
+    // The whole file: pages of older builds were written with a larger Page, which page_upgrade converts
+    size_t read = fread(page, 1, PAGE_SIZE, file);
+    fclose(file);
+
+    if (read < sizeof(Page)) {
+        printf("Failed to read page from file!\n");
+        return 1;
+    }
+    memset((char*)page + read, 0, PAGE_SIZE - read); // page may be a recycled frame
+    return 0;
+}
+
+Page* load_page(int page_id, const char* data_dir) {
+    if (data_dir == NULL) {
+        printf("Invalid data directory!\n");
         return NULL;
     }
 
-    Page* page = calloc(1, sizeof(Page));
+    Page* page = create_page();
     if (page == NULL) {
         printf("Failed to allocate memory for Page!\n");
-        fclose(file);
         return NULL;
     }
+    // A missing file is not reported, as it is expected that the page may not exist, and is created if it doesn't
+    if (read_page_file(page_id, data_dir, page) != 0) {
+        free_page(page);
+        return NULL;
+    }
+    return page;
+}
 
-    size_t read = fread(page, sizeof(Page), 1, file);
-    fclose(file);
+// Single data file backend: page_id lives at byte offset page_id * PAGE_SIZE of data_dir/PAGER_DATA_FILE
+static int open_data_file(Pager* pager) {
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s/%s", pager->data_dir, PAGER_DATA_FILE);
+    pager->fd = open(filename, O_RDWR | O_CREAT | (pager->direct ? O_DIRECT : 0), 0644);
+    if (pager->fd < 0 && pager->direct && errno == EINVAL) {
+        printf("%s does not support O_DIRECT, using buffered I/O.\n", filename);
+        pager->direct = false;
+        pager->fd = open(filename, O_RDWR | O_CREAT, 0644);
+    }
+    if (pager->fd < 0) {
+        printf("Failed to open data file %s!\n", filename);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(pager->fd, &st) != 0) {
+        printf("Failed to stat data file %s!\n", filename);
+        close(pager->fd);
+        pager->fd = -1;
+        return 1;
+    }
+    pager->file_pages = (st.st_size + PAGE_SIZE - 1) / PAGE_SIZE;
+    pager->reserved_pages = pager->file_pages;
+    return 0;
+}
 
-    if (read != 1) {
-        printf("Failed to read page from file!\n");
-        free(page);
+// Reserves disk blocks ahead of the end of file in PAGER_PREALLOC_PAGES extents, so appending
+// pages one at a time does not fragment the file. The file size itself still only grows on write.
+static void reserve_pages(Pager* pager, size_t needed_pages) {
+    if (needed_pages <= pager->reserved_pages) {
+        return;
+    }
+    size_t target = needed_pages + PAGER_PREALLOC_PAGES;
+#ifdef FALLOC_FL_KEEP_SIZE
+    if (fallocate(pager->fd, FALLOC_FL_KEEP_SIZE, (off_t)pager->reserved_pages * PAGE_SIZE,
+                  (off_t)(target - pager->reserved_pages) * PAGE_SIZE) != 0) {
+        pager_trace("Preallocation of data file failed, continuing without it.\n");
+    }
+#endif
+    pager->reserved_pages = target;
+}
+
+// io_uring: batches of page I/O on the single data file go to pager->ring with one submission, see PagerConfig.io_uring
+
+// Submits the batch queued on pager->ring. Returns 0 if it ran; otherwise the ring is given up for good, and
+// the caller does the batch with pread / pwrite instead.
+static int ring_submit(Pager* pager, size_t ops) {
+    if (io_ring_submit(pager->ring) != 0) {
+        printf("Giving up on io_uring for %s, using pread / pwrite!\n", pager->data_dir);
+        io_ring_free(pager->ring);
+        pager->ring = NULL;
+        return 1;
+    }
+    pager->ring_ops += ops;
+    pager->ring_submits++;
+    return 0;
+}
+
+// Reads page_id into the PAGE_SIZE bytes at page. Returns 1 if the page does not exist yet or cannot be read.
+static int read_page_into(Pager* pager, int page_id, Page* page) {
+    if (pager->storage == PAGER_STORAGE_PAGE_FILES) {
+        return read_page_file(page_id, pager->data_dir, page);
+    }
+    if ((size_t)page_id >= pager->file_pages) {
+        return 1; // Past the end of the file, the page does not exist yet
+    }
+    ssize_t n = pread(pager->fd, page, PAGE_SIZE, (off_t)page_id * PAGE_SIZE);
+    if (n < 0) {
+        printf("Failed to read Page %d from data file!\n", page_id);
+        return 1;
+    }
+    // A short read can only be the zero-filled tail of a page that was never written: an empty page
+    memset((char*)page + n, 0, PAGE_SIZE - n);
+    return 0;
+}
+
+// Reads page_id into a page of its own, for the caller to free; NULL if it does not exist yet or cannot be read
+static Page* read_page(Pager* pager, int page_id) {
+    Page* page = create_page();
+    if (page == NULL) {
+        printf("Failed to allocate memory for Page!\n");
+        return NULL;
+    }
+    if (read_page_into(pager, page_id, page) != 0) {
+        free_page(page);
         return NULL;
     }
     return page;
 }
 
-static DLLNode* create_DLLNode(Page* page) {
-    DLLNode* newNode = (DLLNode*)malloc(sizeof(DLLNode));
-    if (newNode == NULL) {
-        printf("Failed to allocate memory for DLLNode!\n");
+// --- Rollback journal ---
+// Before a page is overwritten for the first time after a sync, its contents as of that sync are appended to the
+// journal and the journal is synced; the next sync empties it. A crash in between leaves the saved pages in the
+// journal, and create_pager writes them back, so the file is exactly as it was at the last sync.
+
+typedef struct { // Start of a journal holding pages
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t base_pages; // Pages in the data file at the last sync, the file is cut back to it on rollback
+} JournalHeader;
+
+typedef struct { // Precedes each saved page
+    int64_t page_id;
+    uint64_t checksum; // Of the page contents, so a torn entry at the end is not written back
+} JournalEntry;
+
+#define JOURNAL_ENTRY_SIZE (sizeof(JournalEntry) + PAGE_SIZE)
+
+static uint64_t page_checksum(const void* data) { // FNV-1a
+    const unsigned char* p = data;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool journal_needed(const Pager* pager, int page_id) {
+    if (!pager->journal || page_id < 0) {
+        return false;
+    }
+    if ((size_t)page_id < pager->journaled_pages && (pager->journaled[page_id / 8] >> (page_id % 8)) & 1) {
+        return false; // Already saved since the last sync
+    }
+    // Pages past the end of the file at the last sync have nothing to save; page files do not track their end
+    return pager->storage == PAGER_STORAGE_PAGE_FILES || (size_t)page_id < pager->journal_base_pages;
+}
+
+static int journal_mark(Pager* pager, int page_id) {
+    if ((size_t)page_id >= pager->journaled_pages) {
+        size_t pages = pager->journaled_pages ? 2 * pager->journaled_pages : 512;
+        while (pages <= (size_t)page_id) {
+            pages *= 2;
+        }
+        uint8_t* grown = realloc(pager->journaled, pages / 8);
+        if (grown == NULL) {
+            printf("Failed to grow the journal bitmap!\n");
+            return 1;
+        }
+        memset(grown + pager->journaled_pages / 8, 0, (pages - pager->journaled_pages) / 8);
+        pager->journaled = grown;
+        pager->journaled_pages = pages;
+    }
+    pager->journaled[page_id / 8] |= 1 << (page_id % 8);
+    return 0;
+}
+
+// Saves the on-disk contents of those of count pages that are not in the journal yet, with one journal sync.
+// Returns 0 once they may be overwritten.
+static int journal_save(Pager* pager, const int* page_ids, size_t count) {
+    size_t saved = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!journal_needed(pager, page_ids[i])) {
+            continue;
+        }
+        Page* old = read_page(pager, page_ids[i]);
+        if (old == NULL) {
+            continue; // Never written, so there is nothing to restore
+        }
+        if (pager->journal_entries == 0) {
+            JournalHeader header = { .magic = PAGER_JOURNAL_MAGIC, .base_pages = pager->journal_base_pages };
+            if (pwrite(pager->journal_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+                printf("Failed to write the journal header!\n");
+                free_page(old);
+                return 1;
+            }
+        }
+        JournalEntry entry = { .page_id = page_ids[i], .checksum = page_checksum(old) };
+        off_t offset = sizeof(JournalHeader) + pager->journal_entries * JOURNAL_ENTRY_SIZE;
+        bool failed = pwrite(pager->journal_fd, &entry, sizeof(entry), offset) != (ssize_t)sizeof(entry)
+            || pwrite(pager->journal_fd, old, PAGE_SIZE, offset + sizeof(entry)) != PAGE_SIZE;
+        free_page(old);
+        if (failed) {
+            printf("Failed to save Page %d to the journal!\n", page_ids[i]);
+            return 1;
+        }
+        pager->journal_entries++;
+        saved++;
+    }
+    if (saved > 0 && fdatasync(pager->journal_fd) != 0) {
+        printf("Failed to sync the journal!\n");
+        return 1;
+    }
+    // Only marked once durable, so a failed save is retried by the next write
+    for (size_t i = 0; i < count; i++) {
+        if (journal_needed(pager, page_ids[i]) && journal_mark(pager, page_ids[i]) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Called once the data file is synced: its current state is the new rollback point
+static int journal_commit(Pager* pager) {
+    if (pager->journal_entries > 0) {
+        if (ftruncate(pager->journal_fd, 0) != 0 || fdatasync(pager->journal_fd) != 0) {
+            printf("Failed to empty the journal!\n");
+            return 1;
+        }
+        pager->journal_entries = 0;
+    }
+    if (pager->journaled != NULL) {
+        memset(pager->journaled, 0, pager->journaled_pages / 8);
+    }
+    pager->journal_base_pages = pager->file_pages;
+    return 0;
+}
+
+// Writes the saved pages back after a crash. Returns 0 on success, also when there was nothing to restore.
+static int journal_rollback(Pager* pager) {
+    JournalHeader header;
+    if (pread(pager->journal_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || header.magic != PAGER_JOURNAL_MAGIC) {
+        return ftruncate(pager->journal_fd, 0) != 0; // Empty, or torn before its first page was saved
+    }
+    Page* page = create_page();
+    if (page == NULL) {
+        printf("Failed to allocate memory for journal rollback!\n");
+        return 1;
+    }
+    size_t restored = 0;
+    JournalEntry entry;
+    for (off_t offset = sizeof(header); ; offset += JOURNAL_ENTRY_SIZE, restored++) {
+        if (pread(pager->journal_fd, &entry, sizeof(entry), offset) != (ssize_t)sizeof(entry)
+            || pread(pager->journal_fd, page, PAGE_SIZE, offset + sizeof(entry)) != PAGE_SIZE
+            || page_checksum(page) != entry.checksum || entry.page_id < 0 || entry.page_id > INT32_MAX) {
+            break; // End of the journal, or torn while the page it saved was still intact
+        }
+        int failed;
+        if (pager->storage == PAGER_STORAGE_PAGE_FILES) {
+            failed = save_page(entry.page_id, page, pager->data_dir);
+        } else {
+            failed = pwrite(pager->fd, page, PAGE_SIZE, (off_t)entry.page_id * PAGE_SIZE) != PAGE_SIZE;
+        }
+        if (failed) {
+            printf("Failed to restore Page %" PRId64 " from the journal!\n", entry.page_id);
+            free_page(page);
+            return 1;
+        }
+    }
+    free_page(page);
+    if (pager->storage == PAGER_STORAGE_SINGLE_FILE) {
+        if (ftruncate(pager->fd, (off_t)header.base_pages * PAGE_SIZE) != 0 || fsync(pager->fd) != 0) {
+            printf("Failed to restore the data file size from the journal!\n");
+            return 1;
+        }
+        pager->file_pages = pager->reserved_pages = header.base_pages;
+    }
+    if (ftruncate(pager->journal_fd, 0) != 0 || fdatasync(pager->journal_fd) != 0) {
+        return 1;
+    }
+    printf("Rolled back %zu pages of %s to their last sync\n", restored, pager->data_dir);
+    return 0;
+}
+
+static int write_page(Pager* pager, int page_id, Page* page) {
+    if (journal_needed(pager, page_id) && journal_save(pager, &page_id, 1) != 0) {
+        return 1; // Overwriting it now would leave no way back to the last sync
+    }
+    if (pager->storage == PAGER_STORAGE_PAGE_FILES) {
+        return save_page(page_id, page, pager->data_dir);
+    }
+    reserve_pages(pager, page_id + 1);
+    ssize_t n = pwrite(pager->fd, page, PAGE_SIZE, (off_t)page_id * PAGE_SIZE);
+    if (n != PAGE_SIZE) {
+        printf("Failed to write Page %d to data file!\n", page_id);
+        return 1;
+    }
+    if ((size_t)page_id >= pager->file_pages) {
+        pager->file_pages = page_id + 1;
+    }
+    return 0;
+}
+
+// Memory-mapped mode: pages are handed out as pointers into a MAP_SHARED mapping of the data file,
+// so there is no copy in or out and no cache bookkeeping; the kernel page cache is the buffer pool.
+// The mapping sits at the start of PAGER_MMAP_RESERVE_PAGES of reserved address space and grows by mapping
+// the next part of the file over the reservation, so a page pointer stays valid however much the file grows.
+static int map_data_file(Pager* pager, size_t map_pages) {
+    if (map_pages < PAGER_MMAP_MIN_PAGES) {
+        map_pages = PAGER_MMAP_MIN_PAGES;
+    }
+    if (pager->map == NULL) {
+        void* base = mmap(NULL, PAGER_MMAP_RESERVE_PAGES * PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base != MAP_FAILED && map_pages <= PAGER_MMAP_RESERVE_PAGES
+            && mmap(base, map_pages * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, pager->fd, 0) != MAP_FAILED) {
+            pager->map = base;
+            pager->map_reserved_pages = PAGER_MMAP_RESERVE_PAGES;
+        } else {
+            if (base != MAP_FAILED) {
+                munmap(base, PAGER_MMAP_RESERVE_PAGES * PAGE_SIZE);
+            }
+            // No room to reserve: map just the file, which then moves when it grows
+            void* map = mmap(NULL, map_pages * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, pager->fd, 0);
+            if (map == MAP_FAILED) {
+                printf("Failed to map data file!\n");
+                return 1;
+            }
+            pager->map = map;
+        }
+    } else if (pager->map_reserved_pages > 0) {
+        if (map_pages > pager->map_reserved_pages) {
+            printf("Data file outgrew the %zu pages reserved for its mapping!\n", pager->map_reserved_pages);
+            return 1;
+        }
+        size_t offset = pager->map_pages * PAGE_SIZE;
+        if (mmap(pager->map + offset, map_pages * PAGE_SIZE - offset, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                 pager->fd, (off_t)offset) == MAP_FAILED) {
+            printf("Failed to extend the data file mapping!\n");
+            return 1;
+        }
+    } else {
+        // Grow in place when the address space after the mapping is free, move it otherwise.
+        // Moving invalidates earlier Page pointers, pinned ones too, so only a single thread survives it.
+        void* map = mremap(pager->map, pager->map_pages * PAGE_SIZE, map_pages * PAGE_SIZE, MREMAP_MAYMOVE);
+        if (map == MAP_FAILED) {
+            printf("Failed to remap data file!\n");
+            return 1;
+        }
+        pager->map = map;
+    }
+    pager->map_pages = map_pages;
+    madvise(pager->map, pager->map_pages * PAGE_SIZE, pager->advice);
+    return 0;
+}
+
+static Page* mmap_get(Pager* pager, int page_id) {
+    size_t needed = (size_t)page_id + 1;
+    if (needed > pager->file_pages) {
+        // Pages past the end of file are created zero-filled by extending the file
+        reserve_pages(pager, needed);
+        if (ftruncate(pager->fd, (off_t)needed * PAGE_SIZE) != 0) {
+            printf("Failed to extend data file for Page %d!\n", page_id);
+            return NULL;
+        }
+        pager->file_pages = needed;
+    }
+    if (needed > pager->map_pages) {
+        size_t map_pages = 2 * pager->map_pages;
+        if (map_pages < needed) {
+            map_pages = needed;
+        }
+        if (pager->map_reserved_pages > 0 && map_pages > pager->map_reserved_pages && needed <= pager->map_reserved_pages) {
+            map_pages = pager->map_reserved_pages;
+        }
+        if (map_data_file(pager, map_pages) != 0) {
+            return NULL;
+        }
+    }
+    return (Page*)(pager->map + (size_t)page_id * PAGE_SIZE);
+}
+
+// Latch of a page in PAGER_MODE_MMAP, which has no cache node to hold it; latches are allocated
+// PAGER_LATCH_CHUNK at a time on first use and kept until the pager is freed. NULL if out of memory.
+static pthread_rwlock_t* mmap_latch(Pager* pager, int page_id) {
+    size_t chunk = (size_t)page_id / PAGER_LATCH_CHUNK;
+    if (chunk >= pager->latch_chunk_count) {
+        size_t count = pager->latch_chunk_count ? 2 * pager->latch_chunk_count : 16;
+        while (count <= chunk) {
+            count *= 2;
+        }
+        pthread_rwlock_t** grown = realloc(pager->latch_chunks, count * sizeof(pthread_rwlock_t*));
+        if (grown == NULL) {
+            printf("Failed to grow the page latch table!\n");
+            return NULL;
+        }
+        memset(grown + pager->latch_chunk_count, 0, (count - pager->latch_chunk_count) * sizeof(pthread_rwlock_t*));
+        pager->latch_chunks = grown;
+        pager->latch_chunk_count = count;
+    }
+    if (pager->latch_chunks[chunk] == NULL) {
+        pthread_rwlock_t* latches = malloc(PAGER_LATCH_CHUNK * sizeof(pthread_rwlock_t));
+        if (latches == NULL) {
+            printf("Failed to allocate page latches!\n");
+            return NULL;
+        }
+        for (size_t i = 0; i < PAGER_LATCH_CHUNK; i++) {
+            pthread_rwlock_init(&latches[i], &pager->latch_attr);
+        }
+        pager->latch_chunks[chunk] = latches;
+    }
+    return &pager->latch_chunks[chunk][page_id % PAGER_LATCH_CHUNK];
+}
+
+int pager_convert_page_files(const char* data_dir) {
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s/%s", data_dir, PAGER_DATA_FILE);
+    if (access(filename, F_OK) == 0) {
+        return 0; // Already using the single data file
+    }
+    Page* page = load_page(0, data_dir);
+    if (page == NULL) {
+        return 0; // No per-page files to convert
+    }
+
+    char tmp_filename[sizeof(filename) + 8];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+    int fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Failed to create %s for conversion!\n", tmp_filename);
+        free_page(page);
+        return -1;
+    }
+
+    // Page files are numbered contiguously from 0, so the first missing one is the end
+    int converted = 0;
+    while (page != NULL) {
+        ssize_t n = pwrite(fd, page, PAGE_SIZE, (off_t)converted * PAGE_SIZE);
+        free_page(page);
+        if (n != PAGE_SIZE) {
+            printf("Failed to write Page %d during conversion!\n", converted);
+            close(fd);
+            remove(tmp_filename);
+            return -1;
+        }
+        converted++;
+        page = load_page(converted, data_dir);
+    }
+    if (fsync(fd) != 0 || close(fd) != 0 || rename(tmp_filename, filename) != 0) {
+        printf("Failed to finish converting page files into %s!\n", filename);
+        remove(tmp_filename);
+        return -1;
+    }
+
+    // Only remove the old layout once the new file is durable in place
+    for (int i = 0; i < converted; i++) {
+        char page_filename[256];
+        snprintf(page_filename, sizeof(page_filename), "%s/page_%d.bin", data_dir, i);
+        remove(page_filename);
+    }
+    printf("Converted %d page files into %s\n", converted, filename);
+    return converted;
+}
+
+static void account_bytes(LRUCache* cache, size_t added, size_t removed);
+
+// --- Frame arena ---
+// The cache's nodes and page frames are allocated once, when the pager is created: capacity + CACHE_SPARE_FRAMES
+// nodes, each owning one PAGE_SIZE frame of a single anonymous mapping for good. Both are only reserved there: a
+// node is set up, and its frame touched, the first time it is needed, so a large pool costs no startup time and
+// no memory until pages fill it. A miss takes a free node, or the next one never used, and reads
+// the page straight into its frame, an eviction hands the node back, so loading and evicting pages never calls
+// malloc or free and the cache's memory stays what it was at start. Only when every slot is taken (more pages
+// pinned at once than the spare frames cover) does a node come from the heap, and it goes back to the heap when
+// it is evicted. With PagerConfig.hugepages the mapping asks for huge pages, explicit ones (MAP_HUGETLB) if the
+// system has some reserved, transparent ones otherwise.
+
+static int create_frames(Pager* pager, size_t slots, bool hugepages) {
+    LRUCache* cache = pager->cache;
+    size_t bytes = slots * PAGE_SIZE;
+    void* frames = MAP_FAILED;
+    cache->frame_backing = "4 KB pages";
+#ifdef MAP_HUGETLB
+    if (hugepages) {
+        size_t huge_bytes = (bytes + PAGER_HUGEPAGE_SIZE - 1) / PAGER_HUGEPAGE_SIZE * PAGER_HUGEPAGE_SIZE;
+        frames = mmap(NULL, huge_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (frames != MAP_FAILED) {
+            bytes = huge_bytes; // The rounding is frames too
+            cache->frame_backing = "huge pages";
+        }
+    }
+#endif
+    if (frames == MAP_FAILED) {
+        // Not committed up front, as frames are touched only once pages fill them
+        frames = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (frames == MAP_FAILED) {
+            printf("Failed to map %zu page frames for the cache!\n", slots);
+            return 1;
+        }
+#ifdef MADV_HUGEPAGE
+        if (hugepages && madvise(frames, bytes, MADV_HUGEPAGE) == 0) {
+            cache->frame_backing = "transparent huge pages";
+        }
+#endif
+        if (hugepages && strcmp(cache->frame_backing, "4 KB pages") == 0) {
+            printf("Huge pages are not available, mapping the page frames with 4 KB pages.\n");
+        }
+    }
+    slots = bytes / PAGE_SIZE;
+    cache->slots = calloc(slots, sizeof(DLLNode));
+    if (cache->slots == NULL) {
+        printf("Failed to allocate the cache's nodes!\n");
+        munmap(frames, bytes);
+        return 1;
+    }
+    cache->frames = frames;
+    cache->frames_bytes = bytes;
+    cache->num_slots = slots;
+    return 0;
+}
+
+// Sets up the next slot never used, or returns NULL if there is none. Slots go out lowest first, so a small working
+// set stays in few huge pages.
+static DLLNode* next_slot(Pager* pager) {
+    LRUCache* cache = pager->cache;
+    if (cache->slots_used == cache->num_slots) {
         return NULL;
     }
-    newNode->page = page;
+    size_t i = cache->slots_used++;
+    DLLNode* node = &cache->slots[i];
+    node->page = (Page*)(cache->frames + i * PAGE_SIZE);
+    pthread_rwlock_init(&node->latch, &pager->latch_attr);
+    account_bytes(cache, PAGE_SIZE + sizeof(DLLNode), 0);
+    return node;
+}
+
+static void free_frames(LRUCache* cache) {
+    for (size_t i = 0; i < cache->slots_used; i++) {
+        pthread_rwlock_destroy(&cache->slots[i].latch);
+    }
+    free(cache->slots);
+    if (cache->frames != NULL) {
+        munmap(cache->frames, cache->frames_bytes);
+    }
+}
+
+// A node for page_id, with a frame whose contents are left to the caller
+static DLLNode* create_DLLNode(Pager* pager, int page_id) {
+    LRUCache* cache = pager->cache;
+    DLLNode* newNode = cache->free_slots;
+    if (newNode != NULL) {
+        cache->free_slots = newNode->next;
+    } else if ((newNode = next_slot(pager)) == NULL) {
+        newNode = (DLLNode*)malloc(sizeof(DLLNode));
+        Page* page = create_page();
+        if (newNode == NULL || page == NULL) {
+            printf("Failed to allocate memory for DLLNode!\n");
+            free(newNode);
+            free_page(page);
+            return NULL;
+        }
+        newNode->page = page;
+        newNode->from_heap = true;
+        pthread_rwlock_init(&newNode->latch, &pager->latch_attr);
+        cache->heap_nodes++;
+        account_bytes(cache, PAGE_SIZE + sizeof(DLLNode), 0);
+    }
+    newNode->page_id = page_id;
     newNode->prev = NULL;
     newNode->next = NULL;
+    newNode->hnext = NULL;
+    newNode->dirty = false;
+    newNode->checkpoint = false;
+    newNode->pins = 0;
     return newNode;
 }
 
+static void free_DLLNode(LRUCache* cache, DLLNode* node) {
+    if (!node->from_heap) { // Back to the arena, latch and frame included
+        node->next = cache->free_slots;
+        cache->free_slots = node;
+        return;
+    }
+    pthread_rwlock_destroy(&node->latch);
+    free_page(node->page); // Free the actual Page data
+    free(node);            // Free the DLLNode
+    account_bytes(cache, 0, PAGE_SIZE + sizeof(DLLNode));
+}
+
 // Helper functions
-// Add a node to the front of the linked list
-static void addNodeToFront(LRUCache* cache, DLLNode* node) {
-    node->next = cache->head;
+// Add a node to the front of one of the queues
+static void addNodeToFront(LRUCache* cache, DLLNode* node, int queue) {
+    node->queue = queue;
+    node->next = cache->head[queue];
     node->prev = NULL;
 
-    if (cache->head != NULL) {
-        cache->head->prev = node;
+    if (cache->head[queue] != NULL) {
+        cache->head[queue]->prev = node;
     }
-    cache->head = node;
+    cache->head[queue] = node;
 
-    if (cache->tail == NULL) { // If list was empty, this is also the tail
-        cache->tail = node;
+    if (cache->tail[queue] == NULL) { // If the queue was empty, this is also the tail
+        cache->tail[queue] = node;
     }
+    cache->queue_size[queue]++;
 }
 
-// Remove a node from anywhere in the linked list
+// Remove a node from anywhere in its queue
 static void removeNode(LRUCache* cache, DLLNode* node) {
+    int queue = node->queue;
     if (node->prev != NULL) {
         node->prev->next = node->next;
     } else { // Node is the head
-        cache->head = node->next;
+        cache->head[queue] = node->next;
     }
 
     if (node->next != NULL) {
         node->next->prev = node->prev;
     } else { // Node is the tail
-        cache->tail = node->prev;
+        cache->tail[queue] = node->prev;
     }
     node->prev = NULL;
     node->next = NULL;
-    //free(node); // Free the node itself, not used, as we free it in LRUCache_put
+    cache->queue_size[queue]--;
+    //free(node); // Free the node itself, not used, as we free it in evict_pages
 }
 
-// LRU functions
-static LRUCache* create_LRUCache() {
-    LRUCache* cache = calloc(1, sizeof(LRUCache));
-    if (cache == NULL) {
-        printf("Failed to allocate memory for LRUCache!\n");
-        return NULL;
+static void moveNodeToFront(LRUCache* cache, DLLNode* node, int queue) {
+    if (node != cache->head[queue]) { // Only move if it's not already the head
+        removeNode(cache, node);
+        addNodeToFront(cache, node, queue);
     }
-    cache->capacity = CACHE_SIZE;
-    cache->current_size = 0;
-    cache->head = NULL;
-    cache->tail = NULL;
-    return cache;
 }
 
-// Get a page from the cache
-static Page* LRUCache_get(LRUCache* cache, int page_id) {
-    DLLNode* current = cache->head;
-    while (current != NULL) {
-        if (current->page->header.page_id == page_id) {
-            // Page found: move its node to the front (MRU) of the linked list
-            if (current != cache->head) { // Only move if it's not already the head
-                removeNode(cache, current);
-                addNodeToFront(cache, current);
-            }
-            printf("Cache Hit: Page %d accessed. Moved to MRU.\n", page_id);
-            return current->page;
-        }
-        current = current->next;
+// Every cached node, in no particular order: for (node = first_node(cache); node; node = next_node(cache, node))
+static DLLNode* first_node(const LRUCache* cache) {
+    return cache->head[0] != NULL ? cache->head[0] : cache->head[1];
+}
+
+static DLLNode* next_node(const LRUCache* cache, const DLLNode* node) {
+    if (node->next != NULL || node->queue == CACHE_QUEUES - 1) {
+        return node->next;
     }
+    return cache->head[1];
+}
 
-    printf("Cache Miss: Page %d not found.\n", page_id);
-    return NULL; // Page not in cache
+// Every cached node, closest to eviction first
+static DLLNode* coldest_node(const LRUCache* cache) {
+    int queue = cache->policy->victim_queue(cache);
+    return cache->tail[queue] != NULL ? cache->tail[queue] : cache->tail[1 - queue];
 }
 
-// Put a page into the cache. Used when the get method returns NULL(cache miss), after the pager reads from disk.
-// This also updates the page if it already exists in the cache.
-static int LRUCache_put(LRUCache* cache, Page* page, const char* data_dir) {
-    if (page == NULL) {
-        printf("Cannot put a NULL page into the cache!\n");
+static DLLNode* next_coldest(const LRUCache* cache, const DLLNode* node) {
+    if (node->prev != NULL) {
+        return node->prev;
+    }
+    int queue = cache->policy->victim_queue(cache);
+    return node->queue == queue ? cache->tail[1 - queue] : NULL;
+}
+
+// Ghost list helpers
+static int create_ghosts(GhostList* ghosts, size_t capacity) {
+    ghosts->capacity = capacity;
+    ghosts->num_buckets = 1;
+    while (ghosts->num_buckets < 2 * capacity) {
+        ghosts->num_buckets <<= 1;
+    }
+    ghosts->ids = malloc(capacity * sizeof(int));
+    ghosts->next = malloc(capacity * sizeof(int));
+    ghosts->buckets = malloc(ghosts->num_buckets * sizeof(int));
+    if (ghosts->ids == NULL || ghosts->next == NULL || ghosts->buckets == NULL) {
         return 1;
     }
+    memset(ghosts->buckets, 0xff, ghosts->num_buckets * sizeof(int)); // All -1
+    return 0;
+}
 
-    // First, check if the page already exists in the cache by traversing the DLL
-    DLLNode* existing_node = NULL;
-    DLLNode* current = cache->head;
-    while (current != NULL) {
-        if (current->page->header.page_id == page->header.page_id) {
-            existing_node = current;
-            break;
+static void free_ghosts(GhostList* ghosts) {
+    free(ghosts->ids);
+    free(ghosts->next);
+    free(ghosts->buckets);
+}
+
+static size_t ghost_bucket(const GhostList* ghosts, int page_id) {
+    return (size_t)((uint32_t)page_id * 2654435761u) & (ghosts->num_buckets - 1);
+}
+
+// Takes page_id out of the list, returns whether it was there
+static bool ghost_take(GhostList* ghosts, int page_id) {
+    if (ghosts->capacity == 0) {
+        return false;
+    }
+    int* link = &ghosts->buckets[ghost_bucket(ghosts, page_id)];
+    while (*link >= 0 && ghosts->ids[*link] != page_id) {
+        link = &ghosts->next[*link];
+    }
+    if (*link < 0) {
+        return false;
+    }
+    int slot = *link;
+    *link = ghosts->next[slot];
+    ghosts->ids[slot] = -1; // Stays in the ring until it comes round
+    return true;
+}
+
+static void ghost_push(GhostList* ghosts, int page_id) {
+    if (ghosts->capacity == 0) {
+        return;
+    }
+    size_t slot;
+    if (ghosts->count < ghosts->capacity) {
+        slot = (ghosts->oldest + ghosts->count++) % ghosts->capacity;
+    } else {
+        slot = ghosts->oldest;
+        ghosts->oldest = (ghosts->oldest + 1) % ghosts->capacity;
+        if (ghosts->ids[slot] >= 0) {
+            ghost_take(ghosts, ghosts->ids[slot]); // Forget the oldest
         }
-        current = current->next;
     }
+    size_t b = ghost_bucket(ghosts, page_id);
+    ghosts->ids[slot] = page_id;
+    ghosts->next[slot] = ghosts->buckets[b];
+    ghosts->buckets[b] = (int)slot;
+}
 
-    if (existing_node != NULL) {
-        // Page already exists in cache, page updated
-        free_page(existing_node->page);
-        existing_node->page = page;
+// --- Replacement policies ---
 
-        // Move the existing node to the front (MRU)
-        if (existing_node != cache->head) {
-            removeNode(cache, existing_node);
-            addNodeToFront(cache, existing_node);
-        }
-        printf("Page %d already in cache. Content updated and moved to MRU.\n", page->header.page_id);
-    } else { // new page to be added
-        DLLNode* newNode = create_DLLNode(page);
+// LRU: one queue in recency order. A sweep over more pages than the cache holds replaces all of them.
+static void lru_admit(LRUCache* cache, DLLNode* node) {
+    addNodeToFront(cache, node, 0);
+}
 
-        addNodeToFront(cache, newNode);
-        cache->current_size++;
+static void lru_hit(LRUCache* cache, DLLNode* node) {
+    moveNodeToFront(cache, node, 0);
+}
 
-        printf("Page %d added to cache. Current size: %d/%d.\n", page->header.page_id, cache->current_size, cache->capacity);
+static void lru_evicted(LRUCache* cache, DLLNode* node) {
+    (void)cache;
+    (void)node;
+}
 
-        // Check for capacity constraints
-        if (cache->current_size > cache->capacity) {
-            DLLNode* lruNode = cache->tail;
-            if (lruNode == NULL) { // Should not happen, but jic
-                printf("Cache size mismatch with tail pointer during removal!\n");
-                return 1;
-            }
-            printf("Cache full. Removing LRU Page %d.\n", lruNode->page->header.page_id);
-            removeNode(cache, lruNode);
-            save_page(lruNode->page, data_dir); // Save the page to disk before removing it from cache
-            free_page(lruNode->page); // Free the actual Page data
-            free(lruNode);           // Free the DLLNode
-            cache->current_size--;
-        }
-    }
+static int lru_victim_queue(const LRUCache* cache) {
+    (void)cache;
     return 0;
 }
 
-// Free all memory associated with the LRU Cache
-static void free_LRUCache(LRUCache* cache, const char *data_dir) {
-    if (cache == NULL) return;
-    DLLNode* current_node = cache->head;
-    while (current_node != NULL) {
-        DLLNode* next_node = current_node->next;
-        save_page(current_node->page, data_dir); // Save the page to disk before freeing
-        // Free the actual Page data and the node itself
-        free_page(current_node->page);
-        free(current_node);           
-        current_node = next_node;
+static const CachePolicy lru_policy = {"LRU", lru_admit, lru_hit, lru_evicted, lru_victim_queue};
+
+// 2Q (Johnson & Shasha): a page seen once enters A1in (queue 0), a FIFO holding a quarter of the cache, and
+// when it is evicted from there only its id is kept, in A1out (the ghost list, half the cache's size). A page
+// missed again while in A1out has proven itself and enters Am (queue 1), an LRU of the rest. Repeated uses of
+// the newest page of A1in are taken as one (a scan reads every row of a page in turn), but a page of A1in
+// used again once others came in moves to Am as well, so a hot set that fits the cache is kept even when
+// nothing is evicted between two scans. A scan thus only cycles A1in, while the pages looked up repeatedly
+// stay in Am.
+#define TWOQ_IN_SHARE 4  // A1in keeps 1/TWOQ_IN_SHARE of the cache
+#define TWOQ_OUT_SHARE 2 // A1out remembers capacity/TWOQ_OUT_SHARE ids
+
+static void twoq_admit(LRUCache* cache, DLLNode* node) {
+    if (ghost_take(&cache->ghosts, node->page_id)) {
+        cache->ghost_hits++;
+        addNodeToFront(cache, node, 1);
+    } else {
+        addNodeToFront(cache, node, 0);
     }
-    cache->head = NULL;
-    cache->tail = NULL;
+}
 
-    free(cache);
-    printf("LRU Cache freed successfully.\n");
+static void twoq_hit(LRUCache* cache, DLLNode* node) {
+    if (node->queue == 1) {
+        moveNodeToFront(cache, node, 1);
+    } else if (node != cache->head[0]) { // Used again after other pages came in, so not by the same scan
+        removeNode(cache, node);
+        addNodeToFront(cache, node, 1);
+    }
 }
 
-Pager* create_pager(const char* data_dir) {
-    Pager* pager = calloc(1, sizeof(Pager));
-    if (pager == NULL) {
-        printf("Failed to allocate memory for Pager!\n");
-        return NULL;
+static void twoq_evicted(LRUCache* cache, DLLNode* node) {
+    if (node->queue == 0) {
+        ghost_push(&cache->ghosts, node->page_id);
     }
-    pager->cache = create_LRUCache();
-    if (pager->cache == NULL) {
-        printf("Failed to allocate LRUCache for Pager!\n");
-        free(pager);
-        return NULL;
+}
+
+static int twoq_victim_queue(const LRUCache* cache) {
+    size_t in_target = cache->capacity / TWOQ_IN_SHARE;
+    if (in_target == 0) {
+        in_target = 1;
     }
-    pager->data_dir = data_dir; // Store the directory of pages
-    printf("Pager created successfully with data directory: %s\n", data_dir);
-    return pager;
+    return cache->queue_size[0] > in_target || cache->queue_size[1] == 0 ? 0 : 1;
 }
 
-void free_pager(Pager* pager) {
-    if (pager == NULL) return;
-    free_LRUCache(pager->cache, pager->data_dir); // Free the LRU Cache
+static const CachePolicy twoq_policy = {"2Q", twoq_admit, twoq_hit, twoq_evicted, twoq_victim_queue};
+
+// Hash table helpers
+static size_t hash_bucket(const LRUCache* cache, int page_id) {
+    // Fibonacci hashing spreads consecutive page ids over the table
+    return (size_t)((uint32_t)page_id * 2654435761u) & (cache->num_buckets - 1);
+}
+
+static DLLNode* hash_find(const LRUCache* cache, int page_id) {
+    DLLNode* node = cache->buckets[hash_bucket(cache, page_id)];
+    while (node != NULL && node->page_id != page_id) {
+        node = node->hnext;
+    }
+    return node;
+}
+
+static void hash_insert(LRUCache* cache, DLLNode* node) {
+    size_t b = hash_bucket(cache, node->page_id);
+    node->hnext = cache->buckets[b];
+    cache->buckets[b] = node;
+}
+
+static void hash_remove(LRUCache* cache, DLLNode* node) {
+    DLLNode** link = &cache->buckets[hash_bucket(cache, node->page_id)];
+    while (*link != NULL && *link != node) {
+        link = &(*link)->hnext;
+    }
+    if (*link != NULL) {
+        *link = node->hnext;
+    }
+    node->hnext = NULL;
+}
+
+static void mark_clean(Pager* pager, DLLNode* node) {
+    node->dirty = false;
+    if (node->checkpoint) {
+        node->checkpoint = false;
+        pager->checkpoint_pending--;
+    }
+}
+
+static void set_dirty(Pager* pager, DLLNode* node) {
+    node->dirty = true;
+    node->version = ++pager->dirty_seq;
+    if (pager->flusher_running) {
+        pthread_cond_signal(&pager->flush_wake);
+    }
+}
+
+static bool is_flushing(const Pager* pager, int first_page_id, size_t count) {
+    for (size_t i = 0; i < pager->flushing_count; i++) {
+        if (pager->flushing[i] >= first_page_id && (size_t)(pager->flushing[i] - first_page_id) < count) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Waits until the flusher is not writing any of count pages from first_page_id, so that a read does not
+// see the old contents and a write is not overtaken by an older copy. Called with pager->lock held.
+static void wait_for_flush(Pager* pager, int first_page_id, size_t count) {
+    while (is_flushing(pager, first_page_id, count)) {
+        pthread_cond_wait(&pager->flush_done, &pager->lock);
+    }
+}
+
+// Writes a dropped page back only if it was modified while cached
+static void write_back(Pager* pager, DLLNode* node) {
+    LRUCache* cache = pager->cache;
+    wait_for_flush(pager, node->page_id, 1); // The flusher may be writing it, and may even make it clean
+    if (!node->dirty) {
+        cache->writes_avoided++;
+        return;
+    }
+    if (write_page(pager, node->page_id, node->page) == 0) {
+        cache->pages_written++;
+        mark_clean(pager, node);
+    }
+}
+
+// Writes count dirty pinned nodes through the ring, a ring's worth per submission, and if sync is set has the
+// last submission fsync the data file once the writes are done. Nodes written are marked clean; any left over
+// after a ring failure are written with pwrite. Returns 0 if every write succeeded, and sets *synced if the
+// fsync was done and succeeded, so the caller need not do it again.
+static int ring_write_nodes(Pager* pager, DLLNode** nodes, size_t count, bool sync, bool* synced) {
+    int ret = 0;
+    size_t done = 0;
+    *synced = false;
+    int max_id = -1;
+    for (size_t i = 0; i < count; i++) {
+        if (nodes[i]->page_id > max_id) {
+            max_id = nodes[i]->page_id;
+        }
+    }
+    reserve_pages(pager, max_id + 1);
+    while (pager->ring != NULL && done < count) {
+        int slots[IO_RING_ENTRIES];
+        size_t n = count - done;
+        if (n > IO_RING_ENTRIES - 1) {
+            n = IO_RING_ENTRIES - 1; // Leaves room for the fsync
+        }
+        for (size_t i = 0; i < n; i++) {
+            DLLNode* node = nodes[done + i];
+            slots[i] = io_ring_write(pager->ring, pager->fd, node->page, PAGE_SIZE, (off_t)node->page_id * PAGE_SIZE);
+        }
+        int fsync_slot = sync && done + n == count ? io_ring_fsync(pager->ring, pager->fd) : -1;
+        if (ring_submit(pager, n + (fsync_slot >= 0)) != 0) {
+            break;
+        }
+        for (size_t i = 0; i < n; i++) {
+            DLLNode* node = nodes[done + i];
+            if (io_ring_result(pager->ring, slots[i]) != PAGE_SIZE) {
+                printf("Failed to write Page %d to data file!\n", node->page_id);
+                ret = 1;
+                continue;
+            }
+            if ((size_t)node->page_id >= pager->file_pages) {
+                pager->file_pages = node->page_id + 1;
+            }
+            pager->cache->pages_written++;
+            mark_clean(pager, node);
+        }
+        done += n;
+        if (fsync_slot >= 0) {
+            *synced = io_ring_result(pager->ring, fsync_slot) == 0;
+        }
+    }
+    for (; done < count; done++) { // The ring failed
+        if (write_page(pager, nodes[done]->page_id, nodes[done]->page) != 0) {
+            ret = 1;
+            continue;
+        }
+        pager->cache->pages_written++;
+        mark_clean(pager, nodes[done]);
+    }
+    return ret;
+}
+
+// LRU functions
+static void account_bytes(LRUCache* cache, size_t added, size_t removed) {
+    cache->bytes_in_use = cache->bytes_in_use + added - removed;
+    if (cache->bytes_in_use > cache->peak_bytes) {
+        cache->peak_bytes = cache->bytes_in_use;
+    }
+}
+
+static LRUCache* create_LRUCache(size_t capacity, PagerPolicy policy) {
+    LRUCache* cache = calloc(1, sizeof(LRUCache));
+    if (cache == NULL) {
+        printf("Failed to allocate memory for LRUCache!\n");
+        return NULL;
+    }
+    cache->capacity = capacity;
+    cache->current_size = 0;
+    cache->policy = policy == PAGER_POLICY_2Q ? &twoq_policy : &lru_policy;
+    if (policy == PAGER_POLICY_2Q) {
+        if (create_ghosts(&cache->ghosts, capacity / TWOQ_OUT_SHARE + 1) != 0) {
+            printf("Failed to allocate memory for the 2Q ghost list!\n");
+            free_ghosts(&cache->ghosts);
+            free(cache);
+            return NULL;
+        }
+        account_bytes(cache, cache->ghosts.capacity * 2 * sizeof(int) + cache->ghosts.num_buckets * sizeof(int), 0);
+    }
+
+    // Keep the load factor at or below 1/2
+    cache->num_buckets = 1;
+    while (cache->num_buckets < 2 * cache->capacity) {
+        cache->num_buckets <<= 1;
+    }
+    cache->buckets = calloc(cache->num_buckets, sizeof(DLLNode*));
+    if (cache->buckets == NULL) {
+        printf("Failed to allocate memory for LRUCache hash table!\n");
+        free_ghosts(&cache->ghosts);
+        free(cache);
+        return NULL;
+    }
+    account_bytes(cache, sizeof(LRUCache) + cache->num_buckets * sizeof(DLLNode*), 0);
+    return cache;
+}
+
+// Get a page's node from the cache
+static DLLNode* LRUCache_get(LRUCache* cache, int page_id) {
+    DLLNode* node = hash_find(cache, page_id);
+    if (node == NULL) {
+        cache->misses++;
+        pager_trace("Cache Miss: Page %d not found.\n", page_id);
+        return NULL; // Page not in cache
+    }
+    cache->hits++;
+    cache->policy->hit(cache, node); // e.g. move its node to the front (MRU) of its queue
+    pager_trace("Cache Hit: Page %d accessed.\n", page_id);
+    return node;
+}
+
+// Drops the pages the policy ranks coldest until the cache is back within its capacity. Pinned pages are in
+// use and are passed over; if every page is pinned, the cache stays over capacity until some are unpinned.
+static void evict_pages(Pager* pager) {
+    LRUCache* cache = pager->cache;
+    while (cache->current_size > cache->capacity) {
+        DLLNode* lruNode = coldest_node(cache);
+        while (lruNode != NULL && lruNode->pins > 0) {
+            lruNode = next_coldest(cache, lruNode);
+        }
+        if (lruNode == NULL) {
+            pager_trace("Cache full, but every page is pinned.\n");
+            return;
+        }
+        if (is_flushing(pager, lruNode->page_id, 1)) {
+            // Stays cached (and pinned, so nobody else frees it) until the flusher is done, so that a miss on it
+            // meanwhile cannot read the older copy from the file; then the victim is picked again
+            lruNode->pins++;
+            wait_for_flush(pager, lruNode->page_id, 1);
+            lruNode->pins--;
+            continue;
+        }
+        pager_trace("Cache full. Removing Page %d.\n", lruNode->page_id);
+        cache->policy->evicted(cache, lruNode);
+        removeNode(cache, lruNode);
+        hash_remove(cache, lruNode);
+        size_t written = cache->pages_written;
+        write_back(pager, lruNode); // Save the page to disk before removing it from cache, if modified
+        if (cache->pages_written != written) {
+            cache->eviction_writes++; // The flusher did not get to it, so this miss paid for a write
+        }
+        if (lruNode->checkpoint) { // Its write failed, so the running checkpoint cannot complete
+            mark_clean(pager, lruNode);
+            pager->checkpoint_failed = true;
+        }
+        free_DLLNode(cache, lruNode);
+        cache->current_size--;
+    }
+}
+
+// Put a node from create_DLLNode, its frame filled, into the cache. Used on a cache miss, after the pager read the
+// page from disk; the caller has made sure the page is not cached already.
+// dirty is set for pages that do not exist on disk yet, so they are written even if never modified.
+// The node is returned pinned, so making room for it cannot evict it; the caller keeps or drops that pin.
+static DLLNode* LRUCache_put(Pager* pager, DLLNode* newNode, bool dirty) {
+    LRUCache* cache = pager->cache;
+    newNode->pins = 1;
+    cache->policy->admit(cache, newNode);
+    hash_insert(cache, newNode);
+    if (dirty) {
+        set_dirty(pager, newNode);
+    }
+    cache->current_size++;
+
+    pager_trace("Page %d added to cache. Current size: %zu/%zu.\n", newNode->page_id, cache->current_size, cache->capacity);
+
+    // Check for capacity constraints
+    evict_pages(pager);
+    return newNode;
+}
+
+// Free all memory associated with the LRU Cache
+static void free_LRUCache(Pager* pager) {
+    LRUCache* cache = pager->cache;
+    if (cache == NULL) return;
+    DLLNode* current_node = first_node(cache);
+    while (current_node != NULL) {
+        DLLNode* next = next_node(cache, current_node);
+        write_back(pager, current_node); // Save the page to disk before freeing, if modified
+        free_DLLNode(cache, current_node);
+        current_node = next;
+    }
+    free_frames(cache);
+
+    free_ghosts(&cache->ghosts);
+    free(cache->buckets);
+    free(cache);
+    printf("LRU Cache freed successfully.\n");
+}
+
+PagerConfig pager_default_config(void) {
+    PagerConfig config = {
+        .cache_pages = CACHE_SIZE,
+        .cache_bytes = 0,
+        .storage = PAGER_STORAGE_SINGLE_FILE,
+        .mode = PAGER_MODE_COPY,
+        .flush_clean_pages = PAGER_FLUSH_CLEAN,
+        .policy = PAGER_POLICY_LRU,
+        .readahead_pages = PAGER_READAHEAD_PAGES,
+        .io_uring = false,
+        .direct_io = false,
+        .hugepages = false
+    };
+    return config;
+}
+
+size_t pager_config_capacity(const PagerConfig* config) {
+    size_t capacity = config->cache_pages;
+    if (capacity == 0) {
+        capacity = config->cache_bytes / CACHE_BYTES_PER_PAGE;
+    }
+    if (capacity > CACHE_MAX_PAGES) {
+        printf("Cache of %zu pages is too large, using %zu\n", capacity, (size_t)CACHE_MAX_PAGES);
+        capacity = CACHE_MAX_PAGES;
+    }
+    return capacity < CACHE_MIN_PAGES ? CACHE_MIN_PAGES : capacity;
+}
+
+// --- Background flusher ---
+// Keeps the flush_clean_pages least recently used pages clean, so an eviction can drop its victim and the
+// miss that caused it only pays for its read. The flusher copies a dirty page under the lock and writes the
+// copy without it (with io_uring, up to PAGER_FLUSH_BATCH pages per round); the page is only marked clean if
+// nobody dirtied it again in the meantime. Pinned pages are
+// left alone: pages are changed while pinned, so an unpinned one cannot change halfway through the copy.
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Dirty pages among the flush_clean_pages closest to eviction; returns the unpinned one closest to it
+static DLLNode* flush_candidates(Pager* pager, size_t* depth) {
+    LRUCache* cache = pager->cache;
+    DLLNode* victim = NULL;
+    size_t seen = 0, dirty = 0;
+    for (DLLNode* node = coldest_node(cache); node != NULL && seen < pager->flush_clean_pages; node = next_coldest(cache, node), seen++) {
+        if (node->dirty) {
+            if (victim == NULL && node->pins == 0 && !is_flushing(pager, node->page_id, 1)) {
+                victim = node;
+            }
+            dirty++;
+        }
+    }
+    if (depth != NULL) {
+        *depth = dirty;
+    }
+    return victim;
+}
+
+// Next page of the running checkpoint that still has to be written and is not pinned; a pinned one is
+// written once its last pager_unpin wakes the flusher
+static DLLNode* checkpoint_candidate(Pager* pager) {
+    for (size_t i = pager->checkpoint_next; i < pager->checkpoint_count; i++) {
+        DLLNode* node = hash_find(pager->cache, pager->checkpoint_pages[i]);
+        if (node != NULL && node->checkpoint) {
+            if (node->pins == 0 && !is_flushing(pager, node->page_id, 1)) {
+                return node; // Stays a candidate until a write of it sticks
+            }
+        } else if (i == pager->checkpoint_next) {
+            pager->checkpoint_next++; // Written or dropped, never looked at again
+        }
+    }
+    return NULL;
+}
+
+// Writes the copies of a flusher round without the lock: one ring submission for all of them when the flusher
+// has a ring, else one write each. failed[i] is set for each copy that could not be written.
+static void flush_copies(Pager* pager, IoRing** ring, char* copies, const int* ids, size_t count, bool* failed) {
+    if (*ring != NULL) {
+        int slots[PAGER_FLUSH_BATCH];
+        for (size_t i = 0; i < count; i++) {
+            slots[i] = io_ring_write(*ring, pager->fd, copies + i * PAGE_SIZE, PAGE_SIZE, (off_t)ids[i] * PAGE_SIZE);
+        }
+        if (io_ring_submit(*ring) == 0) {
+            for (size_t i = 0; i < count; i++) {
+                failed[i] = io_ring_result(*ring, slots[i]) != PAGE_SIZE;
+            }
+            return;
+        }
+        printf("Flusher giving up on io_uring, using pwrite!\n");
+        io_ring_free(*ring);
+        *ring = NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (pager->storage == PAGER_STORAGE_PAGE_FILES) {
+            failed[i] = save_page(ids[i], (Page*)(copies + i * PAGE_SIZE), pager->data_dir) != 0;
+        } else {
+            failed[i] = pwrite(pager->fd, copies + i * PAGE_SIZE, PAGE_SIZE, (off_t)ids[i] * PAGE_SIZE) != PAGE_SIZE;
+        }
+    }
+}
+
+static void* flusher_main(void* arg) {
+    Pager* pager = arg;
+    // With io_uring a round writes up to PAGER_FLUSH_BATCH pages with one submission, on a ring of its own
+    IoRing* ring = pager->use_ring ? io_ring_create(PAGER_FLUSH_BATCH) : NULL;
+    size_t batch = ring != NULL ? PAGER_FLUSH_BATCH : 1;
+    char* copies = NULL; // PAGE_SIZE-aligned, for O_DIRECT
+    if (posix_memalign((void**)&copies, PAGE_SIZE, batch * PAGE_SIZE) != 0) {
+        copies = NULL;
+    }
+    if (copies == NULL) {
+        printf("Failed to allocate the flusher buffer, pages are written on eviction only!\n");
+        io_ring_free(ring);
+        return NULL;
+    }
+    int ids[PAGER_FLUSH_BATCH];
+    uint64_t versions[PAGER_FLUSH_BATCH];
+    bool failed[PAGER_FLUSH_BATCH];
+    pthread_mutex_lock(&pager->lock);
+    while (!pager->flusher_stop) {
+        size_t count = 0;
+        while (count < batch) {
+            DLLNode* node = flush_candidates(pager, NULL);
+            if (node == NULL) {
+                node = checkpoint_candidate(pager);
+            }
+            if (node == NULL) {
+                break;
+            }
+            ids[count] = node->page_id;
+            versions[count] = node->version;
+            memcpy(copies + count * PAGE_SIZE, node->page, PAGE_SIZE);
+            pager->flushing[pager->flushing_count++] = node->page_id; // Not a candidate again this round
+            if (pager->storage == PAGER_STORAGE_SINGLE_FILE) {
+                reserve_pages(pager, node->page_id + 1);
+            }
+            count++;
+        }
+        if (count == 0) {
+            pthread_cond_wait(&pager->flush_wake, &pager->lock);
+            continue;
+        }
+        bool ringed = ring != NULL;
+        pthread_mutex_unlock(&pager->lock);
+
+        uint64_t start = now_ns();
+        flush_copies(pager, &ring, copies, ids, count, failed);
+        uint64_t elapsed = now_ns() - start;
+
+        pthread_mutex_lock(&pager->lock);
+        pager->flushing_count = 0;
+        pthread_cond_broadcast(&pager->flush_done);
+        if (ringed && ring != NULL) {
+            pager->ring_ops += count;
+            pager->ring_submits++;
+        }
+        LRUCache* cache = pager->cache;
+        bool any_failed = false;
+        for (size_t i = 0; i < count; i++) {
+            if (failed[i]) {
+                printf("Flusher failed to write Page %d, it is written on eviction instead!\n", ids[i]);
+                any_failed = true;
+                continue;
+            }
+            if (pager->storage == PAGER_STORAGE_SINGLE_FILE && (size_t)ids[i] >= pager->file_pages) {
+                pager->file_pages = ids[i] + 1;
+            }
+            cache->pages_flushed++;
+            cache->pages_written++;
+            DLLNode* node = hash_find(cache, ids[i]); // May have been evicted, and even reloaded, while unlocked
+            if (node != NULL && node->version == versions[i]) {
+                mark_clean(pager, node);
+            }
+        }
+        cache->flush_ns_total += elapsed;
+        if (elapsed > cache->flush_ns_max) {
+            cache->flush_ns_max = elapsed;
+        }
+        if (any_failed) {
+            // Leave them dirty, and let the next wake-up retry rather than spin on a failing disk
+            pthread_cond_wait(&pager->flush_wake, &pager->lock);
+        }
+    }
+    pthread_mutex_unlock(&pager->lock);
+    io_ring_free(ring);
+    free(copies);
+    return NULL;
+}
+
+// --- Read-ahead ---
+// A page read right after the one before it (or further into the window read ahead for it) extends a sequential run; once the run is PAGER_READAHEAD_TRIGGER
+// reads long (or at once after pager_advise(PAGER_ACCESS_SEQUENTIAL)), the next readahead_pages pages are handed
+// to the prefetcher thread, and again each time the run gets within half a window of what was prefetched. The
+// prefetcher only asks the kernel to read them into its page cache (posix_fadvise), which stays coherent with
+// every write, so the later pread or mapping fault is served from memory and nothing read ahead can go stale.
+
+// Called with pager->lock held, for every page read from the file (copying mode) or touched (mmap mode)
+static void note_read(Pager* pager, int page_id) {
+    if (!pager->prefetcher_running || page_id == pager->last_read_page) {
+        return;
+    }
+    // Pages skipped over because they were cached still leave the run going
+    if (pager->last_read_page >= 0 && page_id > pager->last_read_page &&
+        (page_id == pager->last_read_page + 1 || (size_t)page_id < pager->readahead_end)) {
+        pager->sequential_reads++;
+    } else {
+        pager->sequential_reads = pager->sequential_hint ? PAGER_READAHEAD_TRIGGER : 1;
+        pager->readahead_end = 0;
+    }
+    pager->last_read_page = page_id;
+    if (pager->sequential_reads < PAGER_READAHEAD_TRIGGER) {
+        return;
+    }
+    size_t next = (size_t)page_id + 1;
+    size_t start = next > pager->readahead_end ? next : pager->readahead_end;
+    if (start - next > pager->readahead_pages / 2) {
+        return; // Still far enough ahead
+    }
+    size_t end = next + pager->readahead_pages;
+    if (pager->storage == PAGER_STORAGE_SINGLE_FILE && end > pager->file_pages) {
+        end = pager->file_pages;
+    }
+    if (end <= start) {
+        return;
+    }
+    if (pager->prefetch_count > 0 && pager->prefetch_first + pager->prefetch_count == start) {
+        pager->prefetch_count += end - start; // Not picked up yet: extend it
+    } else {
+        pager->prefetch_first = start;
+        pager->prefetch_count = end - start;
+    }
+    pager->readahead_end = end;
+    pthread_cond_signal(&pager->prefetch_wake);
+}
+
+static void prefetch_pages(Pager* pager, size_t first, size_t count) {
+    if (pager->storage == PAGER_STORAGE_SINGLE_FILE) {
+        posix_fadvise(pager->fd, (off_t)first * PAGE_SIZE, (off_t)count * PAGE_SIZE, POSIX_FADV_WILLNEED);
+        return;
+    }
+    char filename[256];
+    for (size_t i = first; i < first + count; i++) {
+        snprintf(filename, sizeof(filename), "%s/page_%zu.bin", pager->data_dir, i);
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            break; // Page files are numbered contiguously, so the first missing one is the end
+        }
+        posix_fadvise(fd, 0, PAGE_SIZE, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
+
+static void* prefetcher_main(void* arg) {
+    Pager* pager = arg;
+    pthread_mutex_lock(&pager->lock);
+    while (!pager->prefetcher_stop) {
+        if (pager->prefetch_count == 0) {
+            pthread_cond_wait(&pager->prefetch_wake, &pager->lock);
+            continue;
+        }
+        size_t first = pager->prefetch_first;
+        size_t count = pager->prefetch_count;
+        pager->prefetch_count = 0;
+        pager->readahead_windows++;
+        pager->readahead_issued += count;
+        pthread_mutex_unlock(&pager->lock);
+        prefetch_pages(pager, first, count);
+        pthread_mutex_lock(&pager->lock);
+    }
+    pthread_mutex_unlock(&pager->lock);
+    return NULL;
+}
+
+static void stop_prefetcher(Pager* pager) {
+    if (!pager->prefetcher_running) {
+        return;
+    }
+    pthread_mutex_lock(&pager->lock);
+    pager->prefetcher_stop = true;
+    pthread_cond_signal(&pager->prefetch_wake);
+    pthread_mutex_unlock(&pager->lock);
+    pthread_join(pager->prefetcher, NULL);
+    pager->prefetcher_running = false;
+}
+
+static void stop_flusher(Pager* pager) {
+    if (!pager->flusher_running) {
+        return;
+    }
+    pthread_mutex_lock(&pager->lock);
+    pager->flusher_stop = true;
+    pthread_cond_signal(&pager->flush_wake);
+    pthread_mutex_unlock(&pager->lock);
+    pthread_join(pager->flusher, NULL);
+    pager->flusher_running = false;
+}
+
+Pager* create_pager(const char* data_dir, const PagerConfig* config) {
+    PagerConfig defaults = pager_default_config();
+    if (config == NULL) {
+        config = &defaults;
+    }
+    Pager* pager = calloc(1, sizeof(Pager));
+    if (pager == NULL) {
+        printf("Failed to allocate memory for Pager!\n");
+        return NULL;
+    }
+    pager->cache = create_LRUCache(pager_config_capacity(config), config->policy);
+    if (pager->cache == NULL) {
+        printf("Failed to allocate LRUCache for Pager!\n");
+        free(pager);
+        return NULL;
+    }
+    pager->data_dir = data_dir; // Store the directory of pages
+    pager->storage = config->storage;
+    pager->mode = config->mode;
+    pager->fd = -1;
+    pager->advice = MADV_NORMAL;
+    pager->journal_fd = -1;
+    pager->last_read_page = -1;
+    pthread_mutex_init(&pager->lock, NULL);
+    pthread_cond_init(&pager->flush_wake, NULL);
+    pthread_cond_init(&pager->flush_done, NULL);
+    pthread_cond_init(&pager->prefetch_wake, NULL);
+    pthread_rwlockattr_init(&pager->latch_attr);
+    // Writers first: with the default preference a steady stream of readers could hold a hot page forever
+    pthread_rwlockattr_setkind_np(&pager->latch_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    if (config->journal) {
+        pager->journal = true;
+        pager->mode = PAGER_MODE_COPY; // Writes to a mapping reach the file without asking, so they cannot be journaled first
+    }
+    if (pager->mode == PAGER_MODE_MMAP && pager->storage != PAGER_STORAGE_SINGLE_FILE) {
+        printf("Memory-mapped mode needs the single data file, using it.\n");
+        pager->storage = PAGER_STORAGE_SINGLE_FILE;
+    }
+
+    // The mapping is the cache in PAGER_MODE_MMAP, so only the copying mode gets frames of its own
+    if (pager->mode == PAGER_MODE_COPY &&
+        create_frames(pager, pager->cache->capacity + CACHE_SPARE_FRAMES, config->hugepages) != 0) {
+        free_LRUCache(pager);
+        free(pager);
+        return NULL;
+    }
+
+    if (mkdir(data_dir, 0755) != 0 && errno != EEXIST) {
+        printf("Failed to create data directory %s!\n", data_dir);
+    }
+    if (config->direct_io) {
+        // Pages in the mapping are the kernel's page cache, and page files are read through stdio
+        pager->direct = pager->mode == PAGER_MODE_COPY && pager->storage == PAGER_STORAGE_SINGLE_FILE;
+        if (!pager->direct) {
+            printf("Direct I/O needs the single data file in copy mode, using buffered I/O.\n");
+        }
+    }
+    if (pager->storage == PAGER_STORAGE_SINGLE_FILE) {
+        if (pager_convert_page_files(data_dir) < 0 || open_data_file(pager) != 0) {
+            free_LRUCache(pager);
+            free(pager);
+            return NULL;
+        }
+    }
+    if (pager->mode == PAGER_MODE_MMAP && map_data_file(pager, pager->file_pages) != 0) {
+        free_LRUCache(pager);
+        close(pager->fd);
+        free(pager);
+        return NULL;
+    }
+    if (pager->journal) {
+        char filename[256];
+        snprintf(filename, sizeof(filename), "%s/%s", data_dir, PAGER_JOURNAL_FILE);
+        pager->journal_fd = open(filename, O_RDWR | O_CREAT, 0644);
+        if (pager->journal_fd < 0 || journal_rollback(pager) != 0) {
+            printf("Failed to open or roll back journal %s!\n", filename);
+            free_LRUCache(pager);
+            if (pager->journal_fd >= 0) {
+                close(pager->journal_fd);
+            }
+            if (pager->fd >= 0) {
+                close(pager->fd);
+            }
+            free(pager);
+            return NULL;
+        }
+        pager->journal_base_pages = pager->file_pages;
+    }
+    if (config->io_uring && pager->mode == PAGER_MODE_COPY && pager->storage == PAGER_STORAGE_SINGLE_FILE) {
+        pager->ring = io_ring_create(IO_RING_ENTRIES);
+        if (pager->ring == NULL) {
+            printf("io_uring is not available, reading and writing pages with pread / pwrite.\n");
+        }
+        pager->use_ring = pager->ring != NULL;
+    }
+    // With mmap the kernel writes pages back itself, so only the copying mode gets a flusher;
+    // a journaled pager writes so rarely that it does without one
+    if (pager->mode == PAGER_MODE_COPY && config->flush_clean_pages > 0 && !pager->journal) {
+        pager->flush_clean_pages = config->flush_clean_pages;
+        if (pthread_create(&pager->flusher, NULL, flusher_main, pager) == 0) {
+            pager->flusher_running = true;
+        } else {
+            printf("Failed to start the flusher thread, pages are written on eviction only!\n");
+        }
+    }
+    // Read-ahead fills the kernel's page cache, which reads with O_DIRECT go past
+    if (config->readahead_pages > 0 && !pager->direct) {
+        pager->readahead_pages = config->readahead_pages;
+        if (pthread_create(&pager->prefetcher, NULL, prefetcher_main, pager) == 0) {
+            pager->prefetcher_running = true;
+        } else {
+            printf("Failed to start the prefetcher thread, pages are read on demand only!\n");
+        }
+    }
+    printf("Pager created successfully with data directory: %s, cache capacity: %zu pages\n", data_dir, pager->cache->capacity);
+    return pager;
+}
+
+void free_pager(Pager* pager) {
+    if (pager == NULL) return;
+    stop_prefetcher(pager);
+    stop_flusher(pager);
+    if (pager->journal) {
+        pager_sync(pager); // Written back with one journal sync, and committed
+    }
+    free_LRUCache(pager); // Free the LRU Cache
+    io_ring_free(pager->ring);
+    if (pager->map != NULL) { // Modified pages reach the file through the kernel page cache
+        munmap(pager->map, (pager->map_reserved_pages > 0 ? pager->map_reserved_pages : pager->map_pages) * PAGE_SIZE);
+    }
+    for (size_t i = 0; i < pager->latch_chunk_count; i++) {
+        if (pager->latch_chunks[i] != NULL) {
+            for (size_t j = 0; j < PAGER_LATCH_CHUNK; j++) {
+                pthread_rwlock_destroy(&pager->latch_chunks[i][j]);
+            }
+            free(pager->latch_chunks[i]);
+        }
+    }
+    free(pager->latch_chunks);
+    if (pager->fd >= 0) {
+        close(pager->fd);
+    }
+    if (pager->journal_fd >= 0) {
+        close(pager->journal_fd);
+    }
+    free(pager->journaled);
+    free(pager->checkpoint_pages);
+    pthread_cond_destroy(&pager->flush_done);
+    pthread_cond_destroy(&pager->flush_wake);
+    pthread_cond_destroy(&pager->prefetch_wake);
+    pthread_mutex_destroy(&pager->lock);
+    pthread_rwlockattr_destroy(&pager->latch_attr);
     free(pager);
     printf("Pager freed successfully.\n");
 }
 
+// The page the eviction after a miss will drop, if it is dirty and can be written along with the miss's read;
+// NULL otherwise, e.g. while the flusher writes it
+static DLLNode* dirty_victim(Pager* pager) {
+    LRUCache* cache = pager->cache;
+    if (cache->current_size < cache->capacity) {
+        return NULL;
+    }
+    DLLNode* node = coldest_node(cache);
+    while (node != NULL && node->pins > 0) {
+        node = next_coldest(cache, node);
+    }
+    if (node == NULL || !node->dirty || is_flushing(pager, node->page_id, 1)) {
+        return NULL;
+    }
+    return node;
+}
+
+// Reads page_id for a miss that will evict the dirty victim, writing the victim back in the same ring
+// submission; the eviction then finds it clean and just drops it
+static int read_page_writing_back(Pager* pager, int page_id, DLLNode* victim, Page* page) {
+    reserve_pages(pager, victim->page_id + 1);
+    int write_slot = io_ring_write(pager->ring, pager->fd, victim->page, PAGE_SIZE, (off_t)victim->page_id * PAGE_SIZE);
+    int read_slot = io_ring_read(pager->ring, pager->fd, page, PAGE_SIZE, (off_t)page_id * PAGE_SIZE);
+    if (ring_submit(pager, 2) != 0) {
+        return read_page_into(pager, page_id, page); // The victim is written by its eviction as usual
+    }
+    if (io_ring_result(pager->ring, write_slot) == PAGE_SIZE) {
+        if ((size_t)victim->page_id >= pager->file_pages) {
+            pager->file_pages = victim->page_id + 1;
+        }
+        pager->cache->pages_written++;
+        pager->cache->eviction_writes++;
+        mark_clean(pager, victim);
+    }
+    int64_t n = io_ring_result(pager->ring, read_slot);
+    if (n < 0) {
+        printf("Failed to read Page %d from data file!\n", page_id);
+        return 1;
+    }
+    // A short read can only be the zero-filled tail of a page that was never written: an empty page
+    memset((char*)page + n, 0, PAGE_SIZE - n);
+    return 0;
+}
+
+// Returns the cached node of a page, loading it on a miss, with one more pin on it
+static DLLNode* pin_node(Pager* pager, int page_id) {
+    // Try to get the page from the cache
+    DLLNode* node = LRUCache_get(pager->cache, page_id);
+    if (node != NULL) {
+        node->pins++;
+        return node; // Cache hit
+    }
+
+    // Cache miss: Load the page from disk
+    pager_trace("Loading Page %d from disk.\n", page_id);
+    note_read(pager, page_id);
+    wait_for_flush(pager, page_id, 1);
+    node = hash_find(pager->cache, page_id); // Another thread may have loaded it while this one waited
+    if (node != NULL) {
+        node->pins++;
+        return node;
+    }
+    DLLNode* victim = NULL;
+    if (pager->ring != NULL && !pager->journal && (size_t)page_id < pager->file_pages) {
+        victim = dirty_victim(pager);
+    }
+    node = create_DLLNode(pager, page_id);
+    if (node == NULL) {
+        return NULL;
+    }
+    int missing = victim != NULL ? read_page_writing_back(pager, page_id, victim, node->page)
+                                 : read_page_into(pager, page_id, node->page);
+    if (missing) {
+        pager_trace("Failed to load Page : %d! Creating page\n", page_id);
+        // If the page does not exist, it starts out empty
+        memset(node->page, 0, PAGE_SIZE);
+    }
+
+    // Put the newly loaded page into the cache
+    return LRUCache_put(pager, node, missing);
+}
+
+static Page* pager_get_locked(Pager *pager, int page_id) {
+    if (pager->mode == PAGER_MODE_MMAP) {
+        note_read(pager, page_id);
+        return mmap_get(pager, page_id);
+    }
+    DLLNode* node = pin_node(pager, page_id);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->pins--; // Unpinned: valid until it is evicted
+    return node->page;
+}
+
 Page* pager_get(Pager *pager, int page_id) {
     if (pager == NULL || pager->cache == NULL) {
         printf("Pager or its cache is NULL!\n");
         return NULL;
     }
+    pthread_mutex_lock(&pager->lock);
+    Page* page = pager_get_locked(pager, page_id);
+    pthread_mutex_unlock(&pager->lock);
+    return page;
+}
 
-    // Try to get the page from the cache
-    Page* page = LRUCache_get(pager->cache, page_id);
+static void lock_latch(pthread_rwlock_t* latch, PagerLatch mode) {
+    if (mode == PAGER_LATCH_SHARED) {
+        pthread_rwlock_rdlock(latch);
+    } else if (mode == PAGER_LATCH_EXCLUSIVE) {
+        pthread_rwlock_wrlock(latch);
+    }
+}
+
+Page* pager_pin(Pager* pager, int page_id, PagerLatch latch) {
+    if (pager == NULL || pager->cache == NULL || page_id < 0) {
+        printf("Cannot pin Page %d!\n", page_id);
+        return NULL;
+    }
+    pthread_mutex_lock(&pager->lock);
+    Page* page = NULL;
+    pthread_rwlock_t* page_latch = NULL;
+    if (pager->mode == PAGER_MODE_MMAP) {
+        page_latch = mmap_latch(pager, page_id);
+        note_read(pager, page_id);
+        page = page_latch != NULL ? mmap_get(pager, page_id) : NULL;
+    } else {
+        DLLNode* node = pin_node(pager, page_id);
+        if (node != NULL) {
+            page = node->page;
+            page_latch = &node->latch;
+        }
+    }
+    pthread_mutex_unlock(&pager->lock);
     if (page != NULL) {
-        return page; // Cache hit
+        lock_latch(page_latch, latch); // Waited for without the pager lock, so other pages stay available meanwhile
     }
+    return page;
+}
 
-    // Cache miss: Load the page from disk
-    printf("Loading Page %d from disk.\n", page_id);
-    page = load_page(page_id, pager->data_dir);
-    if (page == NULL) {
-        printf("Failed to load Page : %d! Creating page\n", page_id);
-        // If the page does not exist, create a new one
-        page = (Page*)calloc(1, sizeof(Page));
-        if (page == NULL) {
-            printf("Failed to allocate memory for new Page!\n");
-            return NULL;
+void pager_unpin(Pager* pager, int page_id, PagerLatch latch, bool dirty) {
+    if (pager == NULL || pager->cache == NULL || page_id < 0) {
+        return;
+    }
+    pthread_mutex_lock(&pager->lock);
+    if (pager->mode == PAGER_MODE_MMAP) { // Stores into the mapping already modify the file
+        if (latch != PAGER_LATCH_NONE) {
+            pthread_rwlock_unlock(mmap_latch(pager, page_id)); // Allocated by the pin
         }
-        page->header.page_id = page_id; // Set the new page ID
+        pthread_mutex_unlock(&pager->lock);
+        return;
+    }
+    DLLNode* node = hash_find(pager->cache, page_id);
+    if (node == NULL || node->pins == 0) {
+        printf("Cannot unpin Page %d, it is not pinned!\n", page_id);
+        pthread_mutex_unlock(&pager->lock);
+        return;
+    }
+    if (latch != PAGER_LATCH_NONE) {
+        pthread_rwlock_unlock(&node->latch);
     }
+    if (dirty) {
+        set_dirty(pager, node);
+    }
+    node->pins--;
+    if (node->pins == 0 && node->dirty && pager->flusher_running) {
+        pthread_cond_signal(&pager->flush_wake); // It may be one the flusher passed over while pinned
+    }
+    pthread_mutex_unlock(&pager->lock);
+}
+
+void pager_get_stats(Pager* pager, PagerStats* stats) {
+    if (pager == NULL || pager->cache == NULL || stats == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pager->lock);
+    stats->capacity_pages = pager->cache->capacity;
+    stats->cached_pages = pager->cache->current_size;
+    stats->bytes_in_use = pager->cache->bytes_in_use;
+    stats->peak_bytes = pager->cache->peak_bytes;
+    stats->pages_written = pager->cache->pages_written;
+    stats->writes_avoided = pager->cache->writes_avoided;
+    stats->mapped_bytes = pager->map_pages * PAGE_SIZE;
+    stats->eviction_writes = pager->cache->eviction_writes;
+    stats->flush_queue_depth = 0;
+    if (pager->flusher_running) {
+        flush_candidates(pager, &stats->flush_queue_depth);
+    }
+    stats->pages_flushed = pager->cache->pages_flushed;
+    stats->flush_avg_us = pager->cache->pages_flushed ? pager->cache->flush_ns_total / 1e3 / pager->cache->pages_flushed : 0;
+    stats->flush_max_us = pager->cache->flush_ns_max / 1e3;
+    stats->checkpoint_pending = pager->checkpoint_pending;
+    stats->policy = pager->cache->policy->name;
+    stats->cache_hits = pager->cache->hits;
+    stats->cache_misses = pager->cache->misses;
+    stats->ghost_hits = pager->cache->ghost_hits;
+    stats->readahead_windows = pager->readahead_windows;
+    stats->readahead_pages = pager->readahead_issued;
+    stats->ring_ops = pager->ring_ops;
+    stats->ring_submits = pager->ring_submits;
+    stats->direct_io = pager->direct;
+    stats->frame_slots = pager->cache->num_slots;
+    stats->frames_used = pager->cache->slots_used;
+    stats->frame_backing = pager->cache->frame_backing;
+    stats->heap_nodes = pager->cache->heap_nodes;
+    pthread_mutex_unlock(&pager->lock);
+}
+
+void pager_advise(Pager* pager, PagerAccess access) {
+    if (pager == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pager->lock);
+    pager->sequential_hint = access == PAGER_ACCESS_SEQUENTIAL; // Read-ahead starts with the scan's first read
+    pager->last_read_page = -1;
+    pthread_mutex_unlock(&pager->lock);
+    if (pager->fd < 0) {
+        return; // Per-page files get no kernel hints
+    }
+    int advice = MADV_NORMAL;
+    int fadvice = POSIX_FADV_NORMAL;
+    if (access == PAGER_ACCESS_SEQUENTIAL) {
+        advice = MADV_SEQUENTIAL;
+        fadvice = POSIX_FADV_SEQUENTIAL;
+    } else if (access == PAGER_ACCESS_RANDOM) {
+        advice = MADV_RANDOM;
+        fadvice = POSIX_FADV_RANDOM;
+    }
+    pthread_mutex_lock(&pager->lock);
+    pager->advice = advice; // Kept so a remapped region gets the same hint
+    if (pager->map != NULL) {
+        madvise(pager->map, pager->map_pages * PAGE_SIZE, advice);
+    } else {
+        posix_fadvise(pager->fd, 0, 0, fadvice);
+    }
+    pthread_mutex_unlock(&pager->lock);
+}
 
-    // Put the newly created page into the cache
-    if (LRUCache_put(pager->cache, page, pager->data_dir) != 0) {
-        printf("Failed to put Page %d into cache!\n", page_id);
-        free_page(page); // Free the page if it could not be added to cache; This is a memory leak prevention
+void pager_mark_dirty(Pager* pager, int page_id) {
+    if (pager == NULL || pager->cache == NULL || pager->mode == PAGER_MODE_MMAP) {
+        return; // Stores into the mapping already modify the file
+    }
+    pthread_mutex_lock(&pager->lock);
+    DLLNode* node = hash_find(pager->cache, page_id);
+    if (node == NULL) {
+        printf("Cannot mark Page %d dirty, it is not cached!\n", page_id);
+    } else {
+        set_dirty(pager, node);
+    }
+    pthread_mutex_unlock(&pager->lock);
+}
+
+static int write_pages_locked(Pager* pager, int first_page_id, const void* data, size_t count) {
+    wait_for_flush(pager, first_page_id, count); // An older copy must not land after these
+    if (pager->journal) {
+        int* ids = malloc(count * sizeof(int));
+        if (ids == NULL) {
+            return 1;
+        }
+        for (size_t i = 0; i < count; i++) {
+            ids[i] = first_page_id + i;
+        }
+        int failed = journal_save(pager, ids, count);
+        free(ids);
+        if (failed) {
+            return 1;
+        }
+    }
+    const char* bytes = data;
+    size_t end = (size_t)first_page_id + count;
+    if (pager->mode == PAGER_MODE_MMAP) {
+        if (mmap_get(pager, end - 1) == NULL) { // Extends and maps the file up to the last page
+            return 1;
+        }
+        memcpy(pager->map + (size_t)first_page_id * PAGE_SIZE, bytes, count * PAGE_SIZE);
+        return 0;
+    }
+    if (pager->storage == PAGER_STORAGE_PAGE_FILES) {
+        for (size_t i = 0; i < count; i++) {
+            if (save_page(first_page_id + i, (Page*)(bytes + i * PAGE_SIZE), pager->data_dir) != 0) {
+                return 1;
+            }
+        }
+    } else {
+        reserve_pages(pager, end);
+        size_t total = count * PAGE_SIZE, done = 0;
+        const char* src = bytes;
+        char* aligned = NULL;
+        if (pager->direct && (uintptr_t)bytes % PAGE_SIZE != 0) { // O_DIRECT cannot write from it
+            if (posix_memalign((void**)&aligned, PAGE_SIZE, total) != 0) {
+                printf("Failed to allocate an aligned buffer for Pages %d to %zu!\n", first_page_id, end - 1);
+                return 1;
+            }
+            memcpy(aligned, bytes, total);
+            src = aligned;
+        }
+        while (done < total) { // pwrite may write less than asked for large buffers
+            ssize_t n = pwrite(pager->fd, src + done, total - done, (off_t)first_page_id * PAGE_SIZE + done);
+            if (n <= 0) {
+                printf("Failed to write Pages %d to %zu to data file!\n", first_page_id, end - 1);
+                free(aligned);
+                return 1;
+            }
+            done += n;
+        }
+        free(aligned);
+        if (end > pager->file_pages) {
+            pager->file_pages = end;
+        }
+    }
+    pager->cache->pages_written += count;
+    // A cached copy of a written page would be stale, so it takes the new contents and is now clean
+    for (size_t i = 0; i < count; i++) {
+        DLLNode* node = hash_find(pager->cache, first_page_id + i);
+        if (node != NULL) {
+            memcpy(node->page, bytes + i * PAGE_SIZE, PAGE_SIZE);
+            mark_clean(pager, node);
+        }
+    }
+    return 0;
+}
+
+int pager_write_pages(Pager* pager, int first_page_id, const void* data, size_t count) {
+    if (pager == NULL || first_page_id < 0 || data == NULL) {
+        return 1;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    pthread_mutex_lock(&pager->lock);
+    int ret = write_pages_locked(pager, first_page_id, data, count);
+    pthread_mutex_unlock(&pager->lock);
+    return ret;
+}
+
+Page* pager_load_page(Pager* pager, int page_id) {
+    if (pager == NULL || page_id < 0) {
         return NULL;
     }
-    return page; // Return the newly loaded page
-}
\ No newline at end of file
+    pthread_mutex_lock(&pager->lock);
+    wait_for_flush(pager, page_id, 1);
+    Page* page = read_page(pager, page_id);
+    pthread_mutex_unlock(&pager->lock);
+    return page;
+}
+
+int pager_delete_files(Pager* pager, size_t num_pages) {
+    if (pager == NULL) {
+        return 0;
+    }
+    // Nothing cached may be written back once the files are gone
+    pthread_mutex_lock(&pager->lock);
+    for (DLLNode* node = first_node(pager->cache); node != NULL; node = next_node(pager->cache, node)) {
+        mark_clean(pager, node);
+    }
+    pthread_mutex_unlock(&pager->lock);
+
+    char filepath[512];
+    int deleted_count = 0;
+    if (pager->journal) {
+        snprintf(filepath, sizeof(filepath), "%s/%s", pager->data_dir, PAGER_JOURNAL_FILE);
+        remove(filepath);
+    }
+    if (pager->storage == PAGER_STORAGE_SINGLE_FILE) {
+        snprintf(filepath, sizeof(filepath), "%s/%s", pager->data_dir, PAGER_DATA_FILE);
+        printf("Attempting to delete: %s\n", filepath);
+        if (remove(filepath) == 0) {
+            printf("Successfully deleted: %s\n", filepath);
+            deleted_count++;
+        } else {
+            printf("Could not delete: %s\n", filepath);
+        }
+        return deleted_count;
+    }
+    for (size_t i = 0; i < num_pages; ++i) {
+        snprintf(filepath, sizeof(filepath), "%s/page_%zu.bin", pager->data_dir, i);
+        printf("Attempting to delete: %s\n", filepath);
+        if (remove(filepath) == 0) {
+            printf("Successfully deleted: %s\n", filepath);
+            deleted_count++;
+        } else {
+            printf("Could not delete: %s\n", filepath);
+        }
+    }
+    return deleted_count;
+}
+
+static int sync_locked(Pager* pager) {
+    int ret = 0;
+    if (pager->journal && pager->cache->current_size > 0) { // Save every page about to be overwritten with one journal sync
+        int* ids = malloc(pager->cache->current_size * sizeof(int));
+        if (ids == NULL) {
+            return 1;
+        }
+        size_t count = 0;
+        for (DLLNode* node = first_node(pager->cache); node != NULL; node = next_node(pager->cache, node)) {
+            if (node->dirty) {
+                ids[count++] = node->page_id;
+            }
+        }
+        int failed = journal_save(pager, ids, count);
+        free(ids);
+        if (failed) {
+            return 1;
+        }
+    }
+    // With the ring, the dirty pages are collected (and stay pinned) and written in batches along with the fsync
+    DLLNode** batch = pager->ring != NULL ? malloc(pager->cache->current_size * sizeof(DLLNode*)) : NULL;
+    size_t batched = 0;
+    for (DLLNode* node = first_node(pager->cache); node != NULL; node = next_node(pager->cache, node)) {
+        node->pins++; // Waiting drops the lock; pinned, the node cannot be evicted from under the loop meanwhile
+        wait_for_flush(pager, node->page_id, 1);
+        if (node->dirty && batch != NULL) {
+            batch[batched++] = node;
+            continue;
+        }
+        node->pins--;
+        if (node->dirty) {
+            if (write_page(pager, node->page_id, node->page) != 0) {
+                ret = 1;
+                continue;
+            }
+            pager->cache->pages_written++;
+            mark_clean(pager, node);
+        }
+    }
+    bool synced = false;
+    if (batched > 0) {
+        ret |= ring_write_nodes(pager, batch, batched, true, &synced);
+        for (size_t i = 0; i < batched; i++) {
+            batch[i]->pins--;
+        }
+    }
+    free(batch);
+    if (pager->map != NULL && msync(pager->map, pager->file_pages * PAGE_SIZE, MS_SYNC) != 0) {
+        ret = 1;
+    }
+    if (pager->fd >= 0 && !synced && fsync(pager->fd) != 0) {
+        ret = 1;
+    }
+    if (ret == 0 && pager->journal) {
+        ret = journal_commit(pager);
+    }
+    return ret;
+}
+
+int pager_sync(Pager* pager) {
+    if (pager == NULL) {
+        return 1;
+    }
+    pthread_mutex_lock(&pager->lock);
+    int ret = sync_locked(pager);
+    pthread_mutex_unlock(&pager->lock);
+    return ret;
+}
+
+int pager_truncate(Pager* pager, size_t num_pages) {
+    if (pager == NULL) {
+        return 1;
+    }
+    int ret = 0;
+    pthread_mutex_lock(&pager->lock);
+    LRUCache* cache = pager->cache;
+    for (DLLNode* node = first_node(cache); node != NULL; ) {
+        DLLNode* next = next_node(cache, node);
+        if ((size_t)node->page_id >= num_pages) {
+            node->pins++;
+            wait_for_flush(pager, node->page_id, 1);
+            node->pins--;
+            next = next_node(cache, node); // The queues may have changed while waiting
+            mark_clean(pager, node);
+            removeNode(cache, node);
+            hash_remove(cache, node);
+            free_DLLNode(cache, node);
+            cache->current_size--;
+        }
+        node = next;
+    }
+    if (pager->storage == PAGER_STORAGE_PAGE_FILES) {
+        char filepath[512];
+        for (size_t i = num_pages; ; i++) { // Page files are numbered contiguously, so the first missing one is the end
+            snprintf(filepath, sizeof(filepath), "%s/page_%zu.bin", pager->data_dir, i);
+            if (remove(filepath) != 0) {
+                break;
+            }
+        }
+    } else if (num_pages < pager->file_pages) {
+        if (ftruncate(pager->fd, (off_t)num_pages * PAGE_SIZE) != 0) {
+            printf("Failed to truncate the data file to %zu pages!\n", num_pages);
+            ret = 1;
+        } else {
+            pager->file_pages = num_pages;
+            pager->reserved_pages = num_pages; // The reserved extent went with the truncated tail
+        }
+    }
+    if (pager->journal_base_pages > num_pages) {
+        pager->journal_base_pages = num_pages;
+    }
+    pthread_mutex_unlock(&pager->lock);
+    return ret;
+}
+
+void pager_checkpoint_begin(Pager* pager) {
+    if (pager == NULL || pager->mode == PAGER_MODE_MMAP) {
+        return; // Every change is already in the kernel's page cache; poll just syncs it
+    }
+    pthread_mutex_lock(&pager->lock);
+    for (DLLNode* node = first_node(pager->cache); node != NULL; node = next_node(pager->cache, node)) {
+        node->checkpoint = false;
+    }
+    free(pager->checkpoint_pages);
+    pager->checkpoint_pages = malloc((pager->cache->current_size + 1) * sizeof(int));
+    pager->checkpoint_count = pager->checkpoint_next = pager->checkpoint_pending = 0;
+    pager->checkpoint_failed = false;
+    if (pager->checkpoint_pages == NULL || !pager->flusher_running) {
+        // Nobody to write them in the background: write them now
+        if (sync_locked(pager) != 0) {
+            pager->checkpoint_failed = true;
+        }
+        pthread_mutex_unlock(&pager->lock);
+        return;
+    }
+    for (DLLNode* node = coldest_node(pager->cache); node != NULL; node = next_coldest(pager->cache, node)) { // Closest to eviction first
+        if (node->dirty) {
+            node->checkpoint = true;
+            pager->checkpoint_pages[pager->checkpoint_count++] = node->page_id;
+        }
+    }
+    pager->checkpoint_pending = pager->checkpoint_count;
+    pthread_cond_signal(&pager->flush_wake);
+    pthread_mutex_unlock(&pager->lock);
+}
+
+int pager_checkpoint_poll(Pager* pager) {
+    if (pager == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&pager->lock);
+    int ret = 0;
+    if (pager->checkpoint_failed) {
+        ret = -1;
+    } else if (pager->checkpoint_pending > 0) {
+        ret = 1;
+    } else if (pager->map != NULL && msync(pager->map, pager->file_pages * PAGE_SIZE, MS_SYNC) != 0) {
+        ret = -1;
+    }
+    pthread_mutex_unlock(&pager->lock);
+    if (ret == 0 && pager->fd >= 0 && fsync(pager->fd) != 0) { // The flusher's writes are not synced yet
+        ret = -1;
+    }
+    return ret;
+}
@@ -4,78 +4,624 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "table.h"
 
 static int table_insert_page(Table* table); // Inserts empty page
+static NameIndex* table_name_index(Table* table); // Returns the name index, building it on first use; NULL if it cannot be built
+static void table_push_free(Table* table, int page_id, Page* page); // Links a pinned page that just got a free slot into the free-page list
+// A change the writer has logged but not yet waited on: its page stays pinned until the record is durable
+typedef struct {
+    int page_id; // -1 if there is nothing to wait for
+    uint64_t lsn;
+} TableCommit;
 
-Table* create_table(){
+static int table_log_change(Table* table, int page_id, Page* page, WalRecordType type, int slot, int64_t id, TableCommit* commit); // Logs a row change made to a latched page, returns 0 on success
+static int table_commit(Table* table, TableCommit* commit); // Waits for a logged change to be durable, returns 0 once it is
+static int table_log_ready(Table* table); // Returns 0 if changes can be logged
+static int table_checkpoint(Table* table); // Writes every dirty page now and records the checkpoint, returns 0 on success
+static void table_checkpoint_step(Table* table); // Starts, advances or finishes a fuzzy checkpoint; called after every change
+
+// num_pages is read by lookups in other threads while the writer grows it
+static size_t table_num_pages(Table* table){
+    return __atomic_load_n(&table->num_pages, __ATOMIC_ACQUIRE);
+}
+
+// The primary index as lookups see it, NULL once it was dropped; read once per lookup
+static BTree* table_index(Table* table){
+    return __atomic_load_n(&table->index, __ATOMIC_ACQUIRE);
+}
+
+static void table_set_num_pages(Table* table, size_t num_pages){
+    __atomic_store_n(&table->num_pages, num_pages, __ATOMIC_RELEASE);
+}
+
+// What the recovery scan saw of one page's free-list links
+typedef struct {
+    int32_t next_free;
+    uint8_t listed;
+    uint8_t has_space;
+} PageScan;
+
+// Finds the head of the free-page list from the links stored in the page headers. The list is valid if it
+// holds exactly the pages with a free slot, once each; otherwise (old data files, or a crash between writing
+// two linked pages) it is relinked in page order.
+static void table_recover_free_list(Table* table, const PageScan* scan){
+    uint8_t* referenced = calloc(table->num_pages + 1, 1);
+    size_t listed = 0, with_space = 0;
+    for(size_t i = 0; i < table->num_pages; i++){
+        with_space += scan[i].has_space;
+        if(scan[i].listed){
+            listed++;
+            int32_t next = scan[i].next_free;
+            if(referenced != NULL && next >= 0 && (size_t)next < table->num_pages){
+                referenced[next] = 1;
+            }
+        }
+    }
+    int head = PAGE_NO_NEXT;
+    size_t heads = 0;
+    for(size_t i = 0; referenced != NULL && i < table->num_pages; i++){
+        if(scan[i].listed && !referenced[i]){
+            head = i;
+            heads++;
+        }
+    }
+    bool valid = referenced != NULL && listed == with_space && heads == (listed > 0 ? 1 : 0);
+    free(referenced);
+    size_t walked = 0;
+    for(int page = head; valid && page != PAGE_NO_NEXT; page = scan[page].next_free){
+        if(page < 0 || (size_t)page >= table->num_pages || !scan[page].listed || !scan[page].has_space || ++walked > listed){
+            valid = false;
+        }
+    }
+    if(valid && walked == listed){
+        table->free_head = head;
+        return;
+    }
+    table->free_head = PAGE_NO_NEXT;
+    for(size_t i = table->num_pages; i-- > 0;){ // Pushed from the back, so inserts fill the lowest pages first
+        Page* page = pager_pin(table->pager, i, PAGER_LATCH_EXCLUSIVE);
+        if(page == NULL){
+            continue;
+        }
+        page->header.in_free_list = 0;
+        if(scan[i].has_space){
+            table_push_free(table, i, page);
+        }
+        pager_unpin(table->pager, i, PAGER_LATCH_EXCLUSIVE, true);
+    }
+}
+
+// Gives up on an index that no longer matches the pages, because a rebuild or a change to it could not be done,
+// so lookups scan the pages instead of trusting it. Its files are removed, so the next open starts a new one and
+// rebuilds that. Lookups already on their way through it keep it valid until free_table.
+static void table_drop_index(Table* table){
+    BTree* index = table->index;
+    __atomic_store_n(&table->index, NULL, __ATOMIC_RELEASE);
+    index_delete_files(index);
+    table->dropped_index = index;
+}
+
+// Applies the result of a change to the index, dropping it if the change could not be made
+static void table_index_result(Table* table, int ret){
+    if(ret != 0 && table->index != NULL){
+        printf("Failed to update the index, falling back to linear search!\n");
+        table_drop_index(table);
+    }
+}
+
+// Reads every page to recover the counts and the free-page list, upgrading pages from older builds,
+// and bulk loads the index from the rows if it needs a rebuild. Sets *max_lsn to the newest page LSN found.
+// Returns 0 on success, 1 on failure.
+static int table_scan_pages(Table* table, bool rebuild, uint64_t* max_lsn){
+    Item* items = NULL; // (id, RowLoc) pairs collected for the index rebuild
+    size_t items_cap = 0;
+    PageScan* scan = NULL;
+    size_t scan_cap = 0;
+    size_t num_pages = 0;
+    size_t total_rows = 0;
+    *max_lsn = 0;
+    pager_advise(table->pager, PAGER_ACCESS_SEQUENTIAL);
+    // Pages are numbered contiguously from 0, so the first missing one is the end
+    for (Page* page = pager_load_page(table->pager, 0); page != NULL; page = pager_load_page(table->pager, num_pages)) {
+        int i = num_pages;
+        if (page_upgrade(page)) { // Written by an older build: convert the cached copy too, so it is written back
+            Page* cached = pager_pin(table->pager, i, PAGER_LATCH_EXCLUSIVE);
+            if (cached != NULL) {
+                pager_unpin(table->pager, i, PAGER_LATCH_EXCLUSIVE, page_upgrade(cached));
+            }
+        }
+        if (num_pages == scan_cap) {
+            scan_cap = scan_cap ? 2 * scan_cap : 64;
+            PageScan* grown = realloc(scan, scan_cap * sizeof(PageScan));
+            if (grown == NULL) {
+                printf("Memory allocation for page scan failed!\n");
+                free_page(page);
+                free(scan);
+                free(items);
+                return 1;
+            }
+            scan = grown;
+        }
+        num_pages++;
+        total_rows += page->header.num_rows;
+        if (page->header.lsn > *max_lsn) {
+            *max_lsn = page->header.lsn;
+        }
+        scan[i].next_free = page->header.next_free;
+        scan[i].listed = page->header.in_free_list;
+        scan[i].has_space = page->header.num_rows < NUM_ROWS_PAGE;
+        if (rebuild && total_rows > items_cap) { // The index does not match the pages, so collect every row for it
+            items_cap = total_rows * 2;
+            Item* grown = realloc(items, items_cap * sizeof(Item));
+            if (grown == NULL) {
+                printf("Memory allocation for index rebuild failed, falling back to linear search!\n");
+                free(items);
+                items = NULL;
+                rebuild = false;
+                table_drop_index(table);
+            } else {
+                items = grown;
+            }
+        }
+        if (rebuild) {
+            size_t n = total_rows - page->header.num_rows;
+            for (int j = page_next_row(page, 0); j >= 0; j = page_next_row(page, j + 1)) {
+                items[n].key = page->rows[j].id;
+                items[n].pos.page_slot = i;
+                items[n].pos.row_slot = j;
+                n++;
+            }
+        }
+        free_page(page); // Free the loaded page
+    }
+    pager_advise(table->pager, PAGER_ACCESS_NORMAL);
+    table_set_num_pages(table, num_pages);
+    table->num_rows = total_rows;
+    table_recover_free_list(table, scan);
+    free(scan);
+    if (rebuild && total_rows > 0) {
+        if (index_bulk_load(table->index, items, total_rows) != 0) {
+            printf("Index rebuild failed, falling back to linear search!\n");
+            table_drop_index(table);
+        } else {
+            printf("Rebuilt index with %zu keys\n", total_rows);
+        }
+    }
+    free(items);
+    return 0;
+}
+
+// Writes a table header and fsyncs it. Returns 0 on success.
+static int table_store_meta(Table* table, const TableMeta* meta){
+    if(table->meta_fd < 0){
+        return 1;
+    }
+    if(pwrite(table->meta_fd, meta, sizeof(*meta), 0) != (ssize_t)sizeof(*meta) || fsync(table->meta_fd) != 0){
+        printf("Failed to write the table header!\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Header describing the table as it is now, under the last completed checkpoint
+static TableMeta table_current_meta(Table* table, bool clean, int32_t index_root){
+    TableMeta meta = {
+        .magic = TABLE_MAGIC,
+        .clean = clean,
+        .num_pages = table->num_pages,
+        .num_rows = table->num_rows,
+        .free_head = table->free_head,
+        .index_root = index_root,
+        .checkpoint_lsn = table->checkpoint_lsn
+    };
+    return meta;
+}
+
+static int table_write_meta(Table* table, bool clean, int32_t index_root){
+    TableMeta meta = table_current_meta(table, clean, index_root);
+    return table_store_meta(table, &meta);
+}
+
+// Starts a checkpoint at the end of the log. Called between changes, so the table and the index are exactly as
+// of that LSN: the index is synced at once (its journal makes that its crash state), the header for this point
+// is kept aside, and the table pages dirty now are handed to the pager to write in the background.
+static int table_checkpoint_begin(Table* table){
+    if(table->wal == NULL || table->meta_fd < 0){
+        return 1;
+    }
+    uint64_t lsn = wal_end_lsn(table->wal);
+    if(wal_commit(table->wal, lsn) != 0){ // Changes not yet waited on may be in the index and in pages no longer pinned
+        return 1;
+    }
+    if(table->index != NULL && index_checkpoint(table->index, lsn) != 0){
+        printf("Failed to checkpoint the index!\n");
+        return 1;
+    }
+    table->checkpoint_meta = table_current_meta(table, false, BTREE_NIL);
+    table->checkpoint_meta.checkpoint_lsn = lsn;
+    table->checkpointing = true;
+    pager_checkpoint_begin(table->pager);
+    return 0;
+}
+
+// Once the checkpoint's pages are on disk: records it in the header, then drops the log records it covers
+static int table_checkpoint_finish(Table* table){
+    table->checkpointing = false;
+    if(table_store_meta(table, &table->checkpoint_meta) != 0){
+        return 1;
+    }
+    table->checkpoint_lsn = table->checkpoint_meta.checkpoint_lsn;
+    return wal_truncate(table->wal, table->checkpoint_lsn);
+}
+
+// Sharp checkpoint, used where no change may be in flight (a batch, open and close). The header is written before
+// the index is synced: a crash in between finds the index behind the header and rebuilds it from the pages, which
+// already hold a batch that was never logged.
+static int table_checkpoint(Table* table){
+    if(table->wal == NULL || table->meta_fd < 0){
+        return 1;
+    }
+    table->checkpointing = false; // Superseded: every dirty page is written, not only the fuzzy checkpoint's
+    uint64_t lsn = wal_end_lsn(table->wal);
+    // pager_sync also writes pages still pinned for a change not yet waited on, so the log goes first. If it
+    // cannot be written, the pages still are: they then hold every change, which is how a failed log recovers.
+    wal_commit(table->wal, lsn);
+    if(pager_sync(table->pager) != 0){
+        printf("Failed to write the pages for a checkpoint!\n");
+        return 1;
+    }
+    TableMeta meta = table_current_meta(table, false, BTREE_NIL);
+    meta.checkpoint_lsn = lsn;
+    if(table_store_meta(table, &meta) != 0){
+        return 1;
+    }
+    table->checkpoint_lsn = lsn;
+    if(table->index != NULL && index_checkpoint(table->index, lsn) != 0){
+        printf("Failed to checkpoint the index!\n");
+        return 1;
+    }
+    return wal_truncate(table->wal, lsn);
+}
+
+static void table_checkpoint_step(Table* table){
+    if(!table->checkpointing && (!wal_checkpoint_due(table->wal) || table_checkpoint_begin(table) != 0)){
+        return;
+    }
+    int state = pager_checkpoint_poll(table->pager);
+    if(state == 0){
+        table_checkpoint_finish(table);
+    } else if(state < 0){
+        printf("Checkpoint failed, the log is kept until the next one\n");
+        table->checkpointing = false;
+    }
+}
+
+typedef struct {
+    Table* table;
+    bool index_ops; // Also redo the change in the index, which is as of the checkpoint the replay starts from
+} TableRedo;
+
+// Redoes one logged change, unless the page on disk already has it, and takes the table's bookkeeping from it.
+// Index changes are redone by key and position, so one the index already has is left alone.
+static int table_redo(const WalRecord* record, uint64_t lsn, void* arg){
+    TableRedo* redo = arg;
+    Table* table = redo->table;
+    if(record->page_id < 0 || record->slot < 0 || record->slot >= (int32_t)NUM_ROWS_PAGE){
+        return 0; // Not a record this table could have written, skip it
+    }
+    Page* page = pager_pin(table->pager, record->page_id, PAGER_LATCH_EXCLUSIVE);
+    if(page == NULL){
+        return 1;
+    }
+    bool changed = page_upgrade(page); // Also turns a page that never reached the disk into an empty one
+    if(page->header.lsn < lsn){
+        page->header.page_id = record->page_id;
+        if(record->type == WAL_PUT_ROW){
+            page_put_row(page, record->slot, &record->row);
+        } else {
+            page_delete_row(page, record->slot);
+        }
+        if(record->has_state){
+            page->header.in_free_list = record->in_free_list;
+            page->header.next_free = record->next_free;
+        }
+        page->header.lsn = lsn;
+        changed = true;
+    }
+    pager_unpin(table->pager, record->page_id, PAGER_LATCH_EXCLUSIVE, changed);
+    if(record->has_state){ // Otherwise the page scan after the replay recovers them
+        table->free_head = record->free_head;
+        table->num_rows = record->num_rows;
+    }
+    if((size_t)record->page_id >= table->num_pages){
+        table_set_num_pages(table, record->page_id + 1);
+    }
+    if(redo->index_ops && table->index != NULL){
+        RowLoc pos = { .page_slot = record->page_id, .row_slot = record->slot }, found;
+        bool indexed = index_find(table->index, record->row.id, &found) == 0;
+        bool here = indexed && found.page_slot == pos.page_slot && found.row_slot == pos.row_slot;
+        if(record->type == WAL_PUT_ROW && !here){
+            int ret = indexed ? index_delete(table->index, record->row.id) : 0;
+            table_index_result(table, ret != 0 ? ret : index_insert(table->index, record->row.id, pos));
+        } else if(record->type == WAL_DELETE_ROW && here){
+            table_index_result(table, index_delete(table->index, record->row.id));
+        }
+    }
+    return 0;
+}
+
+Table* create_table(const PagerConfig* config, const WalConfig* wal_config){
     Table* table = calloc(1, sizeof(Table));
     if(table == NULL){
         printf("Memory allocation for table failed!\n");
         return NULL;
     }
-    table->pager = create_pager("data"); // Initialize pager with a directory
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_settype(&mutex_attr, PTHREAD_MUTEX_RECURSIVE); // Building the name index takes it, also from inside a change
+    pthread_mutex_init(&table->write_lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+    pthread_rwlockattr_t rwlock_attr;
+    pthread_rwlockattr_init(&rwlock_attr);
+    pthread_rwlockattr_setkind_np(&rwlock_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&table->names_lock, &rwlock_attr);
+    pthread_rwlockattr_destroy(&rwlock_attr);
+    // The table and the index pagers share the configured cache budget; each still gets at least CACHE_MIN_PAGES
+    PagerConfig table_config = config != NULL ? *config : pager_default_config();
+    PagerConfig index_config = table_config;
+    index_config.cache_pages = table_config.cache_pages / TABLE_INDEX_CACHE_SHARE;
+    index_config.cache_bytes = table_config.cache_bytes / TABLE_INDEX_CACHE_SHARE;
+    table_config.cache_pages -= index_config.cache_pages;
+    table_config.cache_bytes -= index_config.cache_bytes;
+    table->pager = create_pager(TABLE_DATA_DIR, &table_config); // Initialize pager with a directory
     if(table->pager == NULL){
+        pthread_rwlock_destroy(&table->names_lock);
+        pthread_mutex_destroy(&table->write_lock);
         free(table);
         printf("Failed to create pager for table!\n");
         return NULL; // Failed to create pager
     }
-    // Scan existing data to determine highest page and total rows(Persistence of database) (Not the most efficient way, but works for educational purposes)
-    // A better way would be to store the number of pages and rows in a different file
-    int max_page = -1;
-    size_t total_rows = 0;
-    for (int i = 0; i < TABLE_MAX_PAGES; i++) {
-        Page* page = load_page(i, table->pager->data_dir);
-        if (page == NULL)
-            break;
-        max_page = i;
-        total_rows += page->header.num_rows;
-        free_page(page); // Free the loaded page
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s/%s", TABLE_DATA_DIR, TABLE_META_FILE);
+    table->meta_fd = open(filename, O_RDWR | O_CREAT, 0644);
+    if(table->meta_fd < 0){
+        printf("Failed to open table header %s!\n", filename);
+        table->meta_fd = -1;
+        free_pager(table->pager);
+        table->pager = NULL;
+        free_table(table);
+        return NULL;
+    }
+    table->wal = wal_open(TABLE_DATA_DIR, wal_config);
+    if(table->wal == NULL){
+        close(table->meta_fd);
+        table->meta_fd = -1;
+        free_table(table);
+        return NULL;
+    }
+    table->index = open_index(TABLE_DATA_DIR "/index", &index_config);
+    if(table->index == NULL){
+        printf("Failed to open index for table, falling back to linear search!\n");
+    }
+
+    // The last checkpoint is usable if the index was synced at or after it (and is not older than the log) and the
+    // log still holds every change since it; the table is then brought up to date by replaying only those
+    TableMeta meta = {0};
+    uint64_t log_start = wal_start_lsn(table->wal), log_end = wal_end_lsn(table->wal);
+    bool recoverable = pread(table->meta_fd, &meta, sizeof(meta), 0) == (ssize_t)sizeof(meta)
+        && meta.magic == TABLE_MAGIC && table->index != NULL && !table->index->needs_rebuild
+        && table->index->meta.checkpoint_lsn >= meta.checkpoint_lsn && table->index->meta.checkpoint_lsn <= log_end
+        && log_start <= meta.checkpoint_lsn && meta.checkpoint_lsn <= log_end && table->wal->version == WAL_VERSION
+        && (!meta.clean || meta.index_root == table->index->meta.root);
+    TableRedo redo = { .table = table, .index_ops = recoverable };
+    long replayed;
+    if(recoverable){
+        table_set_num_pages(table, meta.num_pages);
+        table->num_rows = meta.num_rows;
+        table->free_head = meta.free_head;
+        table->checkpoint_lsn = meta.checkpoint_lsn;
+        replayed = wal_replay(table->wal, meta.checkpoint_lsn, table_redo, &redo);
+    } else {
+        // Otherwise every logged change is redone into the pages, which are then scanned for the counts and the index
+        if(table->index != NULL && !table->index->needs_rebuild){
+            index_clear(table->index);
+        }
+        replayed = wal_replay(table->wal, 0, table_redo, &redo);
+        if(replayed > 0 && pager_sync(table->pager) != 0){
+            replayed = -1;
+        }
+    }
+    if(replayed < 0){
+        printf("Failed to replay the write-ahead log!\n");
+        wal_close(table->wal);
+        table->wal = NULL; // Keep the log for the next attempt
+        close(table->meta_fd);
+        table->meta_fd = -1; // Leave the header as it was
+        free_table(table);
+        return NULL;
+    }
+    if(replayed > 0){
+        printf("Replayed %ld logged changes\n", replayed);
+    }
+    uint64_t max_lsn = 0;
+    if(!recoverable){
+        if(table_scan_pages(table, table->index != NULL, &max_lsn) != 0){
+            close(table->meta_fd);
+            table->meta_fd = -1; // Leave the header as it was
+            free_table(table);
+            return NULL;
+        }
+        if(max_lsn > log_end){ // The log was lost: start the new one past every page, so later changes are not skipped
+            wal_truncate(table->wal, max_lsn);
+        }
+    }
+    if(recoverable && meta.clean && replayed == 0){
+        // Stay marked unclean on disk until free_table, so a crash is detected on the next open
+        table_write_meta(table, false, BTREE_NIL);
+    } else if(table_checkpoint(table) != 0){ // Make the recovered state the one the next open starts from
+        table_write_meta(table, false, BTREE_NIL);
     }
-    table->num_pages = max_page + 1;
-    table->num_rows = total_rows;
     return table;
 }
 
 void free_table(Table* table){
     if(!table) return;
+    bool clean = false;
     if(table->pager) {
+        // A last checkpoint writes the pages, syncs the index and empties the log before anything is marked clean
+        clean = table->wal != NULL && table->meta_fd >= 0 && table_checkpoint(table) == 0;
         free_pager(table->pager); // Free the pager
     }
-    free_index(&(table->root)); // Free the AVL tree
+    wal_close(table->wal);
+    int32_t index_root = table->index != NULL ? table->index->meta.root : BTREE_NIL;
+    free_index(table->index); // Write back and free the B-Tree
+    free_index(table->dropped_index);
+    if(table->meta_fd >= 0){
+        if(clean){
+            table_write_meta(table, true, index_root); // Last, so a clean header always describes pages and index on disk
+        }
+        close(table->meta_fd);
+    }
+    free_name_index(table->names);
+    pthread_rwlock_destroy(&table->names_lock);
+    pthread_mutex_destroy(&table->write_lock);
     free(table);
 }
 
 static int table_insert_page(Table* table){
-    if(table->num_pages >= TABLE_MAX_PAGES){
+    if(table->num_pages >= INT32_MAX){
         printf("Table is full, cannot insert more pages!\n");
         return 1;
     }
-    
-    table_get_page(table, table->num_pages); // TODO : check this // This adds the page to LRU cache, and creates a new page if it doesn't exist
-    table->num_pages++;
+
+    int page_id = table->num_pages;
+    Page* page = pager_pin(table->pager, page_id, PAGER_LATCH_EXCLUSIVE); // This adds the page to LRU cache, and creates a new page if it doesn't exist
+    if(page == NULL){
+        return 1;
+    }
+    memset(page, 0, sizeof(Page)); // Past the end of the table, so anything on disk is left over from changes a crash lost
+    page->header.layout = PAGE_LAYOUT_LSN;
+    page->header.page_id = page_id;
+    table_push_free(table, page_id, page);
+    pager_unpin(table->pager, page_id, PAGER_LATCH_EXCLUSIVE, true);
+    table_set_num_pages(table, page_id + 1); // Only now may lookups read it
     return 0;
 }
 
-// Doesn't print anything, just updates the RowLoc object
-int table_find_id(Table* table, int64_t id, RowLoc* pos){
-    if(table->num_pages == 0){
-        printf("Table is empty. No rows to scan\n");
+// Appends the change to the log and stamps the page with its LSN. Called under write_lock once the page and the
+// table's counts and free-page list are updated, as the record carries them; id is the row's, which for a put
+// is taken from the page. The wait for the record to be durable is left to table_commit, after the writer has
+// released write_lock and the page's latch, so that the next writer can append meanwhile and share the sync,
+// and lookups of the page never wait on it. Until then the page is kept pinned, which keeps the flusher and
+// eviction from writing it before its record: a page on disk never claims a change the log could have lost.
+// Returns 1 if the change could not be logged; it stays made, and is only durable once a checkpoint writes
+// its page.
+static int table_log_change(Table* table, int page_id, Page* page, WalRecordType type, int slot, int64_t id, TableCommit* commit){
+    WalRecord record = {
+        .type = type,
+        .page_id = page_id,
+        .slot = slot,
+        .in_free_list = page->header.in_free_list,
+        .next_free = page->header.next_free,
+        .free_head = table->free_head,
+        .num_rows = table->num_rows
+    };
+    if(type == WAL_PUT_ROW){
+        record.row = page->rows[slot];
+    } else {
+        record.row.id = id;
+    }
+    uint64_t lsn = wal_append(table->wal, &record);
+    if(lsn == 0){
+        printf("Failed to log the change to Page %d, it is not durable!\n", page_id);
         return 1;
     }
-    if(!table || !pos){
-        printf("Table or RowLoc is NULL\n");
+    page->header.lsn = lsn;
+    if(pager_pin(table->pager, page_id, PAGER_LATCH_NONE) == NULL){ // Cannot fail on a page pinned already
+        return table_commit(table, &(TableCommit){ .page_id = -1, .lsn = lsn });
+    }
+    commit->page_id = page_id;
+    commit->lsn = lsn;
+    return 0;
+}
+
+// Called by the wrappers of the writers after releasing write_lock. Commits arriving while another one syncs
+// the log share the next sync.
+static int table_commit(Table* table, TableCommit* commit){
+    if(commit->lsn == 0){
+        return 0;
+    }
+    int ret = wal_commit(table->wal, commit->lsn);
+    if(ret != 0){
+        printf("Failed to log the change, it is not durable!\n");
+    }
+    if(commit->page_id >= 0){
+        pager_unpin(table->pager, commit->page_id, PAGER_LATCH_NONE, false);
+    }
+    commit->page_id = -1;
+    commit->lsn = 0;
+    return ret;
+}
+
+// Changes are only made while the log can make them durable. Once a log write has failed, a sharp checkpoint
+// writes every change made so far into the pages and empties the log, which gets it going again; while that
+// fails too, changes are refused.
+static int table_log_ready(Table* table){
+    if(!wal_failed(table->wal)){
+        return 0;
+    }
+    if(table_checkpoint(table) != 0 || wal_failed(table->wal)){
+        printf("The write-ahead log cannot be written, refusing the change!\n");
         return 1;
     }
-    // If the index is not empty, use it to find the row
-    if(table->root != NULL)
-        return index_find(&table->root, id, pos);
+    return 0;
+}
 
-    // Simple loop which scans all pages and all rows in those pages to look for valid rows
-    for(size_t i = 0; i < table->num_pages; i++){
-        Page* page = table_get_page(table, i);
+static void table_push_free(Table* table, int page_id, Page* page){
+    if(page->header.in_free_list){
+        return;
+    }
+    page->header.next_free = table->free_head;
+    page->header.in_free_list = 1;
+    table->free_head = page_id;
+}
+
+// Copies the row at pos if it is still the one with the given id, which a change since the index lookup may
+// have deleted. Returns 0 if copied, 1 if not.
+static int table_copy_row(Table* table, int64_t id, RowLoc pos, Row* row){
+    if(pos.page_slot < 0 || (size_t)pos.page_slot >= table_num_pages(table)){
+        return 1;
+    }
+    Page* page = pager_pin(table->pager, pos.page_slot, PAGER_LATCH_SHARED);
+    if(page == NULL){
+        return 1;
+    }
+    int ret = 1;
+    if(page_row_exists(page, pos.row_slot) && page->rows[pos.row_slot].id == id){
+        *row = page->rows[pos.row_slot];
+        ret = 0;
+    }
+    pager_unpin(table->pager, pos.page_slot, PAGER_LATCH_SHARED, false);
+    return ret;
+}
+
+// Finds a row by scanning every page, for a table without its index. Fills pos, and row if not NULL; returns 0 if found.
+static int table_scan_id(Table* table, int64_t id, RowLoc* pos, Row* row){
+    size_t num_pages = table_num_pages(table);
+    for(size_t i = 0; i < num_pages; i++){
+        Page* page = pager_pin(table->pager, i, PAGER_LATCH_SHARED);
+        if(page == NULL){
+            continue;
+        }
         int ind = page_find_row_id(page, id);
+        if(ind != -1 && row != NULL){
+            *row = page->rows[ind];
+        }
+        pager_unpin(table->pager, i, PAGER_LATCH_SHARED, false);
         if(ind != -1){
             pos->page_slot = i;
             pos->row_slot = ind;
@@ -87,16 +633,120 @@ int table_find_id(Table* table, int64_t id, RowLoc* pos){
     return 1;
 }
 
-// Doesn't print anything, just updates the RowLoc object; This cannot use indexing;
-int table_find_name(Table* table, const char* name, RowLoc* pos){
-    if(table->num_pages == 0){
+// Doesn't print anything, just updates the RowLoc object
+int table_find_id(Table* table, int64_t id, RowLoc* pos){
+    if(!table || !pos){
+        printf("Table or RowLoc is NULL\n");
+        return 1;
+    }
+    if(table_num_pages(table) == 0){
         printf("Table is empty. No rows to scan\n");
         return 1;
     }
+    // If the index is available, use it to find the row
+    BTree* index = table_index(table);
+    if(index != NULL)
+        return index_find(index, id, pos);
+
     // Simple loop which scans all pages and all rows in those pages to look for valid rows
+    return table_scan_id(table, id, pos, NULL);
+}
+
+int table_get_row(Table* table, int64_t id, Row* row){
+    if(!table || !row){
+        return 1;
+    }
+    RowLoc pos, last = { .page_slot = -1, .row_slot = -1 };
+    BTree* index = table_index(table);
+    if(index == NULL){
+        return table_scan_id(table, id, &pos, row);
+    }
+    while(index_find(index, id, &pos) == 0){
+        if(table_copy_row(table, id, pos, row) == 0){
+            return 0;
+        }
+        if(pos.page_slot == last.page_slot && pos.row_slot == last.row_slot){
+            return 1; // Still indexed there but gone from the page: a delete is on its way to the index
+        }
+        last = pos; // Deleted and inserted again elsewhere meanwhile, look it up again
+    }
+    return 1;
+}
+
+// Builds the name index with one pass over the pages, so only the first name lookup pays for a full scan.
+// The scan holds the write lock, so no change is missed between it and publishing the index.
+static NameIndex* table_name_index(Table* table){
+    pthread_rwlock_rdlock(&table->names_lock);
+    NameIndex* names = table->names;
+    pthread_rwlock_unlock(&table->names_lock);
+    if(names != NULL){
+        return names;
+    }
+    pthread_mutex_lock(&table->write_lock);
+    if(table->names != NULL){ // Built by another thread meanwhile
+        names = table->names;
+        pthread_mutex_unlock(&table->write_lock);
+        return names;
+    }
+    names = create_name_index();
+    if(names == NULL){
+        pthread_mutex_unlock(&table->write_lock);
+        return NULL;
+    }
+    pager_advise(table->pager, PAGER_ACCESS_SEQUENTIAL);
     for(size_t i = 0; i < table->num_pages; i++){
-        Page* page = table_get_page(table, i);
+        Page* page = pager_pin(table->pager, i, PAGER_LATCH_NONE); // No change can run, so no latch is needed
+        for(int j = page == NULL ? -1 : page_next_row(page, 0); j >= 0; j = page_next_row(page, j + 1)){
+            RowLoc pos = { .page_slot = i, .row_slot = j };
+            if(name_index_insert(names, page->rows[j].name, pos) != 0){
+                pager_unpin(table->pager, i, PAGER_LATCH_NONE, false);
+                free_name_index(names);
+                pager_advise(table->pager, PAGER_ACCESS_NORMAL);
+                pthread_mutex_unlock(&table->write_lock);
+                return NULL;
+            }
+        }
+        if(page != NULL){
+            pager_unpin(table->pager, i, PAGER_LATCH_NONE, false);
+        }
+    }
+    pager_advise(table->pager, PAGER_ACCESS_NORMAL);
+    pthread_rwlock_wrlock(&table->names_lock);
+    table->names = names;
+    pthread_rwlock_unlock(&table->names_lock);
+    pthread_mutex_unlock(&table->write_lock);
+    return names;
+}
+
+// Doesn't print anything, just updates the RowLoc object
+int table_find_name(Table* table, const char* name, RowLoc* pos){
+    if(table_num_pages(table) == 0){
+        printf("Table is empty. No rows to scan\n");
+        return 1;
+    }
+    // If the name index is available, use it to find the row
+    if(table_name_index(table) != NULL){
+        pthread_rwlock_rdlock(&table->names_lock);
+        int found = table->names != NULL ? name_index_find(table->names, name, pos) : -1; // -1 if dropped meanwhile
+        pthread_rwlock_unlock(&table->names_lock);
+        if(found == 0){
+            return 0;
+        }
+        if(found == 1){
+            pos->page_slot = -1;
+            pos->row_slot = -1;
+            return 1;
+        }
+    }
+    // Simple loop which scans all pages and all rows in those pages to look for valid rows
+    size_t num_pages = table_num_pages(table);
+    for(size_t i = 0; i < num_pages; i++){
+        Page* page = pager_pin(table->pager, i, PAGER_LATCH_SHARED);
+        if(page == NULL){
+            continue;
+        }
         int ind = page_find_row_name(page, name);
+        pager_unpin(table->pager, i, PAGER_LATCH_SHARED, false);
         if(ind != -1){
             pos->page_slot = i;
             pos->row_slot = ind;
@@ -108,8 +758,37 @@ int table_find_name(Table* table, const char* name, RowLoc* pos){
     return 1;
 }
 
-int table_insert(Table* table, const Row* row){
-    if(!table || !row){
+// Drops a name index that is missing a row because an entry could not be allocated; the next name lookup builds
+// it again, or scans the pages if that fails too. Called with names_lock held for writing.
+static void table_drop_names(Table* table){
+    printf("Memory allocation for the name index failed, it is rebuilt on the next name lookup\n");
+    free_name_index(table->names);
+    table->names = NULL;
+}
+
+// Changes to the name index, made by the writer once it exists
+static void table_names_insert(Table* table, const char* name, RowLoc pos){
+    if(table->names != NULL){
+        pthread_rwlock_wrlock(&table->names_lock);
+        if(name_index_insert(table->names, name, pos) != 0){
+            table_drop_names(table);
+        }
+        pthread_rwlock_unlock(&table->names_lock);
+    }
+}
+
+static void table_names_delete(Table* table, const char* name, RowLoc pos){
+    if(table->names != NULL){
+        pthread_rwlock_wrlock(&table->names_lock);
+        name_index_delete(table->names, name, pos);
+        pthread_rwlock_unlock(&table->names_lock);
+    }
+}
+
+// Every change runs under table->write_lock, through the wrapper of the same name without _locked, which then
+// waits for the change to be durable with table_commit
+static int table_insert_locked(Table* table, const Row* row, TableCommit* commit){
+    if(table_log_ready(table) != 0){
         return 1;
     }
     if(table->num_pages == 0){
@@ -122,42 +801,189 @@ int table_insert(Table* table, const Row* row){
         printf("Row with this id already exists.\n");
         return 1;
     }
-    //Find a page with free space
-    Page* target_page = NULL;
-    size_t i = 0;
-    for (; i < table->num_pages; i++) {
-        Page* pagee  = table_get_page(table, i);
-        if (pagee && pagee->header.num_rows < NUM_ROWS_PAGE) {
-            target_page = pagee;
-            break;
-        }
+    //Take the page with free space from the head of the free-page list, or create a new page if there is none
+    if(table->free_head == PAGE_NO_NEXT && table_insert_page(table)){
+        return 1;
     }
-    //If no page with free space found, create a new page
+    int i = table->free_head;
+    Page* target_page = pager_pin(table->pager, i, PAGER_LATCH_EXCLUSIVE);
     if(!target_page){
-        if(table_insert_page(table)){
-            return 1;
-        }
-        target_page = table_get_page(table, table->num_pages - 1);
+        return 1;
     }
-    table->num_rows++;
     // Insert the row into the target page
-    int ret = page_insert_row(target_page, row);
-    if(ret != 0){
+    int ind = page_insert_row(target_page, row);
+    if(ind < 0){
         printf("Failed to insert row into page\n");
+        pager_unpin(table->pager, i, PAGER_LATCH_EXCLUSIVE, false);
         return 1;
     }
-    int ind = page_find_row_id(target_page, row->id);
-    if(ind == -1){
-        printf("Failed to find row after insertion\n");
-        return 1;
+    table->num_rows++;
+    if(target_page->header.num_rows == NUM_ROWS_PAGE){ // Page is now full, unlink it
+        table->free_head = target_page->header.next_free;
+        target_page->header.next_free = PAGE_NO_NEXT;
+        target_page->header.in_free_list = 0;
     }
+    int logged = table_log_change(table, i, target_page, WAL_PUT_ROW, ind, row->id, commit);
+    pager_unpin(table->pager, i, PAGER_LATCH_EXCLUSIVE, true);
     pos.page_slot = i;
     pos.row_slot = ind;
-    // Insert the row into the index
-    index_insert(&table->root, row->id, pos);
+    // Insert the row into the indexes, which must match the page whether or not the change is durable
+    table_index_result(table, index_insert(table->index, row->id, pos));
+    table_names_insert(table, row->name, pos);
+    table_checkpoint_step(table);
+    return logged;
+}
+
+int table_insert(Table* table, const Row* row){
+    if(!table || !row){
+        return 1;
+    }
+    TableCommit commit = { .page_id = -1 };
+    pthread_mutex_lock(&table->write_lock);
+    int ret = table_insert_locked(table, row, &commit);
+    pthread_mutex_unlock(&table->write_lock);
+    return table_commit(table, &commit) | ret;
+}
+
+static int compare_ids(const void* a, const void* b){
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Checks a batch before anything is written: valid fields, no id twice, no id already in the table
+static int table_validate_batch(Table* table, const Row* rows, size_t n){
+    int64_t* ids = malloc(n * sizeof(int64_t));
+    if(ids == NULL){
+        printf("Memory allocation for batch validation failed!\n");
+        return 1;
+    }
+    for(size_t k = 0; k < n; k++){
+        if(rows[k].id < 0 || memchr(rows[k].name, '\0', MAX_NAME_SIZE) == NULL || memchr(rows[k].email, '\0', MAX_EMAIL_SIZE) == NULL){
+            printf("Row %zu of the batch is invalid\n", k);
+            free(ids);
+            return 1;
+        }
+        ids[k] = rows[k].id;
+    }
+    qsort(ids, n, sizeof(int64_t), compare_ids);
+    for(size_t k = 0; k < n; k++){
+        RowLoc pos;
+        if(k > 0 && ids[k] == ids[k - 1]){
+            printf("ID %" PRId64 " appears twice in the batch\n", ids[k]);
+            free(ids);
+            return 1;
+        }
+        // In key order, so consecutive lookups share the cached index nodes
+        if(table->num_rows > 0 && table_find_id(table, ids[k], &pos) == 0){
+            printf("Row with ID %" PRId64 " already exists.\n", ids[k]);
+            free(ids);
+            return 1;
+        }
+    }
+    free(ids);
+    return 0;
+}
+
+static int table_insert_batch_locked(Table* table, const Row* rows, size_t n){
+    size_t new_pages = (n + NUM_ROWS_PAGE - 1) / NUM_ROWS_PAGE;
+    if(table->num_pages + new_pages > INT32_MAX){
+        printf("Table is full, cannot insert %zu more pages!\n", new_pages);
+        return 1;
+    }
+    if(table_validate_batch(table, rows, n) != 0){
+        return 1;
+    }
+    Item* items = malloc(n * sizeof(Item));
+    char* chunk = NULL; // Page-aligned, so direct I/O writes it without copying it first
+    if(posix_memalign((void**)&chunk, PAGE_SIZE, TABLE_BATCH_CHUNK_PAGES * PAGE_SIZE) != 0){
+        chunk = NULL;
+    }
+    if(items == NULL || chunk == NULL){
+        printf("Memory allocation for batch insert failed!\n");
+        free(items);
+        free(chunk);
+        return 1;
+    }
+    // Rows go into fresh pages in order, filled in memory and written TABLE_BATCH_CHUNK_PAGES at a time;
+    // holes in older pages are left to single inserts
+    size_t k = 0;
+    int first_page = table->num_pages;
+    int free_head = table->free_head;
+    for(size_t done = 0; done < new_pages; ){
+        size_t count = new_pages - done < TABLE_BATCH_CHUNK_PAGES ? new_pages - done : TABLE_BATCH_CHUNK_PAGES;
+        memset(chunk, 0, count * PAGE_SIZE);
+        for(size_t p = 0; p < count; p++){
+            Page* page = (Page*)(chunk + p * PAGE_SIZE);
+            int page_id = first_page + done + p;
+            page->header.layout = PAGE_LAYOUT_LSN;
+            page->header.page_id = page_id;
+            page->header.next_free = PAGE_NO_NEXT;
+            for(size_t j = 0; j < NUM_ROWS_PAGE && k < n; j++, k++){
+                page->rows[j] = rows[k];
+                page->header.slot_bits[j / 64] |= 1ULL << (j % 64);
+                page->header.num_rows++;
+                items[k].key = rows[k].id;
+                items[k].pos.page_slot = page_id;
+                items[k].pos.row_slot = j;
+            }
+            if(page->header.num_rows < NUM_ROWS_PAGE){ // Only the last page can have room left
+                page->header.in_free_list = 1;
+                page->header.next_free = free_head;
+                free_head = page_id;
+            }
+        }
+        if(pager_write_pages(table->pager, first_page + done, chunk, count) != 0){
+            printf("Failed to write batch pages!\n");
+            // Blank out what was written, so a restart's page scan does not find half a batch
+            memset(chunk, 0, TABLE_BATCH_CHUNK_PAGES * PAGE_SIZE);
+            for(size_t undo = 0; undo < done; undo += TABLE_BATCH_CHUNK_PAGES){
+                size_t blank = done - undo < TABLE_BATCH_CHUNK_PAGES ? done - undo : TABLE_BATCH_CHUNK_PAGES;
+                pager_write_pages(table->pager, first_page + undo, chunk, blank);
+            }
+            free(items);
+            free(chunk);
+            return 1;
+        }
+        done += count;
+    }
+    free(chunk);
+    table->free_head = free_head;
+    size_t existing = table->num_rows;
+    table_set_num_pages(table, table->num_pages + new_pages);
+    table->num_rows += n;
+    if(table->names != NULL){
+        pthread_rwlock_wrlock(&table->names_lock);
+        for(size_t i = 0; i < n; i++){
+            if(name_index_insert(table->names, rows[i].name, items[i].pos) != 0){
+                table_drop_names(table);
+                break;
+            }
+        }
+        pthread_rwlock_unlock(&table->names_lock);
+    }
+    table_index_result(table, index_merge(table->index, items, n, existing)); // Reorders items, so after the name index
+    free(items);
+    // The batch is not logged, so it is made durable by a checkpoint, which syncs its pages and records the counts
+    if(table_checkpoint(table) != 0){
+        printf("Failed to sync batch pages!\n");
+        return 1;
+    }
     return 0;
 }
 
+int table_insert_batch(Table* table, const Row* rows, size_t n){
+    if(!table || !rows){
+        return 1;
+    }
+    if(n == 0){
+        return 0;
+    }
+    pthread_mutex_lock(&table->write_lock);
+    int ret = table_insert_batch_locked(table, rows, n);
+    pthread_mutex_unlock(&table->write_lock);
+    return ret;
+}
+
 int table_insert_record(Table* table, int64_t id, const char* name, const char* email){
     int return_flag=0;
     if(strlen(name)+1 > MAX_NAME_SIZE){
@@ -187,9 +1013,8 @@ int table_insert_record(Table* table, int64_t id, const char* name, const char*
     return table_insert(table, &row);
 }
 
-int table_delete_pos(Table* table, RowLoc pos) {
-    if(!table){
-        printf("Table is empty!\n");
+static int table_delete_pos_locked(Table* table, RowLoc pos, TableCommit* commit) {
+    if(table_log_ready(table) != 0){
         return 1;
     }
     if(table->num_pages == 0){
@@ -200,113 +1025,270 @@ int table_delete_pos(Table* table, RowLoc pos) {
         printf("Invalid page slot\n");
         return 1;
     }
-    Page* target_page = table_get_page(table, pos.page_slot);
-    if(!target_page || pos.row_slot < 0 || pos.row_slot >= (int64_t)NUM_ROWS_PAGE){
+    if(pos.row_slot < 0 || pos.row_slot >= (int64_t)NUM_ROWS_PAGE){
+        printf("Invalid row slot\n");
+        return 1;
+    }
+    Page* target_page = pager_pin(table->pager, pos.page_slot, PAGER_LATCH_EXCLUSIVE);
+    if(!target_page){
         printf("Invalid row slot\n");
         return 1;
     }
     int64_t id_to_delete = target_page->rows[pos.row_slot].id;
+    char name_to_delete[MAX_NAME_SIZE];
+    memcpy(name_to_delete, target_page->rows[pos.row_slot].name, MAX_NAME_SIZE);
     int ret = page_delete_row(target_page, pos.row_slot);
     if(ret != 0){
         printf("Failed to delete row at position (%d, %d)\n", pos.page_slot, pos.row_slot);
+        pager_unpin(table->pager, pos.page_slot, PAGER_LATCH_EXCLUSIVE, false);
         return 1;
     }
+    table_push_free(table, pos.page_slot, target_page); // The page has a free slot again
     table->num_rows--;
-    index_delete(&table->root, id_to_delete); // Delete from index
-    return 0;
+    int logged = table_log_change(table, pos.page_slot, target_page, WAL_DELETE_ROW, pos.row_slot, id_to_delete, commit);
+    pager_unpin(table->pager, pos.page_slot, PAGER_LATCH_EXCLUSIVE, true);
+    table_index_result(table, index_delete(table->index, id_to_delete)); // Delete from index
+    table_names_delete(table, name_to_delete, pos);
+    table_checkpoint_step(table);
+    return logged;
 }
 
-// Returns 0 if row is successfully deleted, 1 otherwise.
-int table_delete_id(Table* table, int64_t id){
+int table_delete_pos(Table* table, RowLoc pos) {
     if(!table){
         printf("Table is empty!\n");
         return 1;
     }
+    TableCommit commit = { .page_id = -1 };
+    pthread_mutex_lock(&table->write_lock);
+    int ret = table_delete_pos_locked(table, pos, &commit);
+    pthread_mutex_unlock(&table->write_lock);
+    return table_commit(table, &commit) | ret;
+}
+
+static int table_delete_id_locked(Table* table, int64_t id, TableCommit* commit){
     if(table->num_pages == 0){
         printf("Table is empty!\n");
         return 1;
     }
 
-    // If the index is not empty, use it to find the row
-    if(table->root != NULL) {
+    // If the index is available, use it to find the row
+    if(table->index != NULL) {
         RowLoc pos;
-        if(index_find(&table->root, id, &pos) == 0) {
-            return table_delete_pos(table, pos);
+        if(index_find(table->index, id, &pos) == 0) {
+            return table_delete_pos_locked(table, pos, commit);
         } else {
             printf("No row has been found with the specified ID!\n");
             return 1;
         }
     }
 
-    for(size_t i = 0; i < table->num_pages; i++){
-        Page* curr_page = table_get_page(table, i);
-        int ind = page_find_row_id(curr_page, id);
-        if(ind != -1) {
-            RowLoc pos = { .page_slot = i, .row_slot = ind };
-            return table_delete_pos(table, pos); // Use the full deletion logic
-        }
+    RowLoc pos;
+    if(table_scan_id(table, id, &pos, NULL) == 0){
+        return table_delete_pos_locked(table, pos, commit); // Use the full deletion logic
     }
     printf("No row has been found with the specified ID!\n");
     return 1;
 }
 
 // Returns 0 if row is successfully deleted, 1 otherwise.
-int table_delete_name(Table* table, const char* name){
+int table_delete_id(Table* table, int64_t id){
     if(!table){
         printf("Table is empty!\n");
         return 1;
     }
+    TableCommit commit = { .page_id = -1 };
+    pthread_mutex_lock(&table->write_lock);
+    int ret = table_delete_id_locked(table, id, &commit);
+    pthread_mutex_unlock(&table->write_lock);
+    return table_commit(table, &commit) | ret;
+}
+
+static int table_delete_name_locked(Table* table, const char* name, TableCommit* commit){
     if(table->num_pages == 0){
         printf("Table is empty!\n");
         return 1;
     }
-    for(size_t i = 0; i < table->num_pages; i++){ 
-        Page* curr_page = table_get_page(table, i);
-        int ind = page_find_row_name(curr_page, name);
-        if(ind != -1) {
-            RowLoc pos = { .page_slot = i, .row_slot = ind };
-            return table_delete_pos(table, pos); // Use the full deletion logic
-        }
+    RowLoc pos;
+    if(table_find_name(table, name, &pos) == 0){
+        return table_delete_pos_locked(table, pos, commit); // Use the full deletion logic
     }
     printf("No row has been found with the specified name!\n");
     return 1;
 }
 
+// Returns 0 if row is successfully deleted, 1 otherwise.
+int table_delete_name(Table* table, const char* name){
+    if(!table){
+        printf("Table is empty!\n");
+        return 1;
+    }
+    TableCommit commit = { .page_id = -1 };
+    pthread_mutex_lock(&table->write_lock);
+    int ret = table_delete_name_locked(table, name, &commit);
+    pthread_mutex_unlock(&table->write_lock);
+    return table_commit(table, &commit) | ret;
+}
+
+static int table_update_row_locked(Table* table, RowLoc pos, const char* name, const char* email, TableCommit* commit){
+    if(table_log_ready(table) != 0){
+        return 1;
+    }
+    if(pos.page_slot < 0 || pos.page_slot >= (int64_t)table->num_pages || pos.row_slot < 0 || pos.row_slot >= (int64_t)NUM_ROWS_PAGE){
+        printf("Invalid row position\n");
+        return 1;
+    }
+    Page* page = pager_pin(table->pager, pos.page_slot, PAGER_LATCH_EXCLUSIVE);
+    if(!page || !page_row_exists(page, pos.row_slot)){
+        printf("No row at position (%d, %d)\n", pos.page_slot, pos.row_slot);
+        if(page){
+            pager_unpin(table->pager, pos.page_slot, PAGER_LATCH_EXCLUSIVE, false);
+        }
+        return 1;
+    }
+    Row* row = &page->rows[pos.row_slot];
+    if(table->names != NULL && strcmp(row->name, name) != 0){ // Re-key the row in the name index
+        pthread_rwlock_wrlock(&table->names_lock);
+        name_index_delete(table->names, row->name, pos);
+        if(name_index_insert(table->names, name, pos) != 0){
+            table_drop_names(table);
+        }
+        pthread_rwlock_unlock(&table->names_lock);
+    }
+    strncpy(row->name, name, MAX_NAME_SIZE);
+    strncpy(row->email, email, MAX_EMAIL_SIZE);
+    int logged = table_log_change(table, pos.page_slot, page, WAL_PUT_ROW, pos.row_slot, row->id, commit);
+    pager_unpin(table->pager, pos.page_slot, PAGER_LATCH_EXCLUSIVE, true);
+    table_checkpoint_step(table);
+    return logged;
+}
+
+int table_update_row(Table* table, RowLoc pos, const char* name, const char* email){
+    if(!table || !name || !email){
+        return 1;
+    }
+    if(strlen(name)+1 > MAX_NAME_SIZE || strlen(email)+1 > MAX_EMAIL_SIZE){
+        printf("Name or email too long\n");
+        return 1;
+    }
+    TableCommit commit = { .page_id = -1 };
+    pthread_mutex_lock(&table->write_lock);
+    int ret = table_update_row_locked(table, pos, name, email, &commit);
+    pthread_mutex_unlock(&table->write_lock);
+    return table_commit(table, &commit) | ret;
+}
+
 void table_print(Table* table){
     if(!table){
         printf("Table is NULL\n");
         return;
     }
-    if(table->num_pages == 0){
+    size_t num_pages = table_num_pages(table);
+    if(num_pages == 0){
         printf("Table is empty. No data to show\n");
         return;
     }
-    for(size_t i = 0; i < table->num_pages; i++){
-        Page* page = table_get_page(table, i);
+    pager_advise(table->pager, PAGER_ACCESS_SEQUENTIAL);
+    for(size_t i = 0; i < num_pages; i++){
+        Page* page = pager_pin(table->pager, i, PAGER_LATCH_SHARED);
         if(page == NULL){
             break;
         }
         printf("Page no: %zu\n", i);
-        size_t j = 0, rows_printed = 0;
-        while(rows_printed < page->header.num_rows){ 
-            if(!page->header.row_exists[j]){
-                j++;
-                continue;  // Skip deleted rows
-            }
+        size_t rows_printed = 0;
+        for(int j = page_next_row(page, 0); j >= 0; j = page_next_row(page, j + 1)){ // Deleted rows are skipped a bitmap word at a time
             Row* row = &page->rows[j];
             assert(row != NULL);  // Ensure row is not NULL
             printf("S.No: %zu, ID: %" PRId64 ", NAME = %s, EMAIL = %s\n",
                 rows_printed, row->id, row->name, row->email);
-            j++;
             rows_printed++;
         }
+        pager_unpin(table->pager, i, PAGER_LATCH_SHARED, false);
         printf("\n");
     }
+    pager_advise(table->pager, PAGER_ACCESS_NORMAL);
 }
 
-Page* table_get_page(Table* table, int page_id) {
-    if(!table || page_id < 0) { // no check for page_id > table->num_pages as this function also handles page creation
+size_t table_scan_range(Table* table, int64_t lo, int64_t hi, TableScanCallback callback, void* arg){
+    if(!table || !callback || lo > hi){
+        return 0;
+    }
+    size_t visited = 0;
+    BTree* index = table_index(table);
+    if(index == NULL){
+        // Without the index every page has to be read, and rows come in storage order
+        size_t num_pages = table_num_pages(table);
+        for(size_t i = 0; i < num_pages; i++){
+            Page* page = pager_pin(table->pager, i, PAGER_LATCH_SHARED);
+            for(int j = page == NULL ? -1 : page_next_row(page, 0); j >= 0; j = page_next_row(page, j + 1)){
+                if(page->rows[j].id >= lo && page->rows[j].id <= hi){
+                    RowLoc pos = { .page_slot = i, .row_slot = j };
+                    Row row = page->rows[j]; // The callback gets a copy, so the page is not latched while it runs
+                    pager_unpin(table->pager, i, PAGER_LATCH_SHARED, false);
+                    visited++;
+                    if(callback(&row, pos, arg) != 0){
+                        return visited;
+                    }
+                    page = pager_pin(table->pager, i, PAGER_LATCH_SHARED);
+                    if(page == NULL){
+                        break;
+                    }
+                }
+            }
+            if(page != NULL){
+                pager_unpin(table->pager, i, PAGER_LATCH_SHARED, false);
+            }
+        }
+        return visited;
+    }
+    // Walk the index from lo a batch at a time, so only the pages holding matching rows are fetched
+    Item items[TABLE_SCAN_BATCH];
+    int64_t from = lo;
+    while(true){
+        size_t n = index_range(index, from, hi, items, TABLE_SCAN_BATCH);
+        for(size_t k = 0; k < n; k++){
+            Row row;
+            if(table_copy_row(table, items[k].key, items[k].pos, &row) != 0){
+                continue; // Deleted since the batch was read
+            }
+            visited++;
+            if(callback(&row, items[k].pos, arg) != 0){
+                return visited;
+            }
+        }
+        if(n < TABLE_SCAN_BATCH || items[n - 1].key >= hi){
+            return visited;
+        }
+        from = items[n - 1].key + 1;
+    }
+}
+
+const Page* table_pin_page(Table* table, int page_id){
+    if(!table || page_id < 0 || (size_t)page_id >= table_num_pages(table)){
         return NULL; // Invalid table or page_id
     }
-    return pager_get(table->pager, page_id); // Return the page with the given ID, NULL if not found
-}
\ No newline at end of file
+    return pager_pin(table->pager, page_id, PAGER_LATCH_SHARED);
+}
+
+void table_unpin_page(Table* table, int page_id){
+    if(!table || page_id < 0){
+        return;
+    }
+    pager_unpin(table->pager, page_id, PAGER_LATCH_SHARED, false);
+}
+
+int table_delete_files(Table* table) {
+    if(!table) {
+        return 0;
+    }
+    int deleted = pager_delete_files(table->pager, table->num_pages) + index_delete_files(table->index) + wal_delete_file(table->wal);
+    if(table->meta_fd >= 0){
+        close(table->meta_fd);
+        table->meta_fd = -1; // Nothing is written back by free_table
+        char filename[256];
+        snprintf(filename, sizeof(filename), "%s/%s", TABLE_DATA_DIR, TABLE_META_FILE);
+        if(remove(filename) == 0){
+            deleted++;
+        }
+    }
+    return deleted;
+}
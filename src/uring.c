@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "uring.h"
+
+// The submission and completion queues are rings shared with the kernel: we produce at the submission tail and
+// the kernel consumes from its head, and the other way round for completions. The indices are read and written
+// with acquire / release ordering, as the kernel does on its side.
+struct IoRing {
+    int fd;
+    unsigned entries;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    size_t sq_map_len;
+    void* cq_map; // Same as sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_len;
+    size_t sqes_len;
+    unsigned queued; // Operations in the current batch
+    bool broken; // A wait for completions failed, so late ones could be taken for the next batch's
+    struct iovec* iovs; // One per slot, READV / WRITEV work on every kernel with io_uring
+    int64_t* results; // One per slot, for the last batch
+};
+
+static int ring_setup(unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ring_enter(int fd, unsigned to_submit, unsigned min_complete) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+IoRing* io_ring_create(unsigned entries) {
+    IoRing* ring = calloc(1, sizeof(IoRing));
+    if (ring == NULL) {
+        return NULL;
+    }
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = ring_setup(entries, &params);
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
+    }
+    ring->entries = params.sq_entries;
+    ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring->cq_map_len > ring->sq_map_len) {
+        ring->sq_map_len = ring->cq_map_len;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_map = single ? ring->sq_map
+                          : mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    ring->iovs = calloc(ring->entries, sizeof(struct iovec));
+    ring->results = calloc(ring->entries, sizeof(int64_t));
+    if (ring->sq_map == MAP_FAILED) {
+        ring->sq_map = NULL;
+    }
+    if (ring->cq_map == MAP_FAILED) {
+        ring->cq_map = NULL;
+    }
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+    }
+    if (ring->sq_map == NULL || ring->cq_map == NULL || ring->sqes == NULL || ring->iovs == NULL || ring->results == NULL) {
+        io_ring_free(ring);
+        return NULL;
+    }
+    char* sq = ring->sq_map;
+    char* cq = ring->cq_map;
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+void io_ring_free(IoRing* ring) {
+    if (ring == NULL) {
+        return;
+    }
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_map != NULL && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_len);
+    }
+    if (ring->sq_map != NULL) {
+        munmap(ring->sq_map, ring->sq_map_len);
+    }
+    close(ring->fd);
+    free(ring->iovs);
+    free(ring->results);
+    free(ring);
+}
+
+unsigned io_ring_space(const IoRing* ring) {
+    return ring->entries - ring->queued;
+}
+
+// Fills the next submission queue entry; returns its slot, or -1 if the batch is full
+static int queue_op(IoRing* ring, uint8_t opcode, int fd, void* buf, size_t len, off_t offset, uint8_t flags) {
+    if (ring->queued == ring->entries) {
+        return -1;
+    }
+    int slot = ring->queued++;
+    unsigned tail = *ring->sq_tail; // Only we move the tail
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->flags = flags;
+    sqe->fd = fd;
+    sqe->off = (uint64_t)offset;
+    sqe->user_data = (uint64_t)slot;
+    if (buf != NULL) {
+        ring->iovs[slot].iov_base = buf;
+        ring->iovs[slot].iov_len = len;
+        sqe->addr = (uint64_t)(uintptr_t)&ring->iovs[slot];
+        sqe->len = 1; // One iovec
+    }
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE); // The entry is visible before the new tail
+    ring->results[slot] = -EINPROGRESS;
+    return slot;
+}
+
+int io_ring_read(IoRing* ring, int fd, void* buf, size_t len, off_t offset) {
+    return queue_op(ring, IORING_OP_READV, fd, buf, len, offset, 0);
+}
+
+int io_ring_write(IoRing* ring, int fd, const void* buf, size_t len, off_t offset) {
+    return queue_op(ring, IORING_OP_WRITEV, fd, (void*)buf, len, offset, 0);
+}
+
+int io_ring_fsync(IoRing* ring, int fd) {
+    return queue_op(ring, IORING_OP_FSYNC, fd, NULL, 0, 0, IOSQE_IO_DRAIN);
+}
+
+int io_ring_submit(IoRing* ring) {
+    if (ring->broken) {
+        for (unsigned i = 0; i < ring->queued; i++) {
+            ring->results[i] = -EIO;
+        }
+        *ring->sq_tail -= ring->queued;
+        ring->queued = 0;
+        return -1;
+    }
+    unsigned to_submit = ring->queued;
+    unsigned pending = ring->queued;
+    int ret = 0;
+    while (pending > 0) {
+        int n = ring_enter(ring->fd, to_submit, pending);
+        if (n < 0) {
+            int err = errno;
+            if (err == EINTR) {
+                continue;
+            }
+            if (to_submit == ring->queued) { // Nothing of the batch reached the kernel
+                printf("io_uring submission failed: %s\n", strerror(err));
+                for (unsigned i = 0; i < ring->queued; i++) {
+                    ring->results[i] = -err;
+                }
+                *ring->sq_tail -= to_submit; // Take the entries back
+                ring->queued = 0;
+                return -1;
+            }
+            printf("io_uring wait failed: %s\n", strerror(err));
+            ring->broken = true;
+            ret = -1;
+            break;
+        }
+        to_submit -= (unsigned)n < to_submit ? (unsigned)n : to_submit;
+        unsigned head = *ring->cq_head; // Only we move the head
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            if (cqe->user_data < ring->entries) {
+                ring->results[cqe->user_data] = cqe->res;
+            }
+            head++;
+            pending--;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE); // The entries are read before the kernel may reuse them
+    }
+    ring->queued = 0;
+    return ret;
+}
+
+int64_t io_ring_result(const IoRing* ring, int slot) {
+    if (slot < 0 || (unsigned)slot >= ring->entries) {
+        return -EINVAL;
+    }
+    return ring->results[slot];
+}
@@ -0,0 +1,589 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "wal.h"
+
+typedef struct { // Start of the log file
+    uint32_t magic;
+    uint32_t version;
+    uint64_t base_lsn; // LSN of the first byte after this header
+} WalFileHeader;
+
+typedef struct { // Start of every record
+    uint32_t crc;     // CRC-32 of the rest of the record, so a torn or unwritten tail is detected
+    uint16_t size;    // Bytes of the whole record, this header included
+    uint8_t type;     // WalRecordType
+    uint8_t in_free_list;
+    int32_t page_id;
+    int32_t slot;
+    int32_t next_free;
+    int32_t free_head;
+    uint64_t num_rows;
+    int64_t id;
+    // WAL_PUT_ROW records go on with uint8_t name length, uint8_t email length, then the name and email
+    // without their terminators
+} WalRecordHeader;
+
+typedef struct { // Start of every record of a version 1 log; WAL_PUT_ROW records go on with int64_t id, then as above
+    uint32_t crc;
+    uint16_t size;
+    uint8_t type;
+    uint8_t pad;
+    int32_t page_id;
+    int32_t slot;
+} WalRecordHeaderV1;
+
+#define WAL_ROW_FIXED 2
+#define WAL_MAX_RECORD (sizeof(WalRecordHeader) + WAL_ROW_FIXED + MAX_NAME_SIZE + MAX_EMAIL_SIZE)
+#define WAL_READ_CHUNK (64 * 1024)
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32(const void* data, size_t len) {
+    const uint8_t* p = data;
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        c = crc_table[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+static off_t lsn_offset(const Wal* wal, uint64_t lsn) {
+    return (off_t)(sizeof(WalFileHeader) + (lsn - wal->base_lsn));
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Encodes a record into out, which holds WAL_MAX_RECORD bytes; returns its size
+static size_t encode_record(char* out, const WalRecord* record) {
+    WalRecordHeader header = {
+        .type = record->type,
+        .in_free_list = record->in_free_list,
+        .page_id = record->page_id,
+        .slot = record->slot,
+        .next_free = record->next_free,
+        .free_head = record->free_head,
+        .num_rows = record->num_rows,
+        .id = record->row.id
+    };
+    size_t size = sizeof(header);
+    if (record->type == WAL_PUT_ROW) {
+        uint8_t name_len = strnlen(record->row.name, MAX_NAME_SIZE - 1);
+        uint8_t email_len = strnlen(record->row.email, MAX_EMAIL_SIZE - 1);
+        char* p = out + size;
+        p[0] = name_len;
+        p[1] = email_len;
+        memcpy(p + WAL_ROW_FIXED, record->row.name, name_len);
+        memcpy(p + WAL_ROW_FIXED + name_len, record->row.email, email_len);
+        size += WAL_ROW_FIXED + name_len + email_len;
+    }
+    header.size = size;
+    memcpy(out, &header, sizeof(header));
+    header.crc = crc32(out + sizeof(uint32_t), size - sizeof(uint32_t));
+    memcpy(out, &header.crc, sizeof(uint32_t));
+    return size;
+}
+
+// Decodes a record of a version 1 log, which only names the change: the table state after it has to be
+// recovered from the pages
+static size_t decode_record_v1(const char* data, size_t avail, WalRecord* record) {
+    WalRecordHeaderV1 header;
+    if (avail < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.size < sizeof(header) || header.size > avail || header.size > WAL_MAX_RECORD
+        || crc32(data + sizeof(uint32_t), header.size - sizeof(uint32_t)) != header.crc) {
+        return 0;
+    }
+    memset(record, 0, sizeof(*record));
+    record->type = header.type;
+    record->page_id = header.page_id;
+    record->slot = header.slot;
+    if (header.type == WAL_DELETE_ROW) {
+        return header.size == sizeof(header) ? header.size : 0;
+    }
+    size_t fixed = sizeof(header) + sizeof(int64_t) + WAL_ROW_FIXED;
+    if (header.type != WAL_PUT_ROW || header.size < fixed) {
+        return 0;
+    }
+    const char* p = data + sizeof(header);
+    uint8_t name_len = p[sizeof(int64_t)];
+    uint8_t email_len = p[sizeof(int64_t) + 1];
+    if (name_len >= MAX_NAME_SIZE || email_len >= MAX_EMAIL_SIZE || header.size != fixed + name_len + email_len) {
+        return 0;
+    }
+    memcpy(&record->row.id, p, sizeof(int64_t));
+    memcpy(record->row.name, data + fixed, name_len);
+    memcpy(record->row.email, data + fixed + name_len, email_len);
+    return header.size;
+}
+
+// Decodes the record at data, of which avail bytes are loaded; returns its size, 0 if it is torn or corrupt
+static size_t decode_record(const Wal* wal, const char* data, size_t avail, WalRecord* record) {
+    if (wal->version == 1) {
+        return decode_record_v1(data, avail, record);
+    }
+    WalRecordHeader header;
+    if (avail < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.size < sizeof(header) || header.size > avail || header.size > WAL_MAX_RECORD
+        || crc32(data + sizeof(uint32_t), header.size - sizeof(uint32_t)) != header.crc) {
+        return 0;
+    }
+    memset(record, 0, sizeof(*record));
+    record->type = header.type;
+    record->page_id = header.page_id;
+    record->slot = header.slot;
+    record->in_free_list = header.in_free_list;
+    record->next_free = header.next_free;
+    record->free_head = header.free_head;
+    record->num_rows = header.num_rows;
+    record->row.id = header.id;
+    record->has_state = true;
+    if (header.type == WAL_DELETE_ROW) {
+        return header.size == sizeof(header) ? header.size : 0;
+    }
+    if (header.type != WAL_PUT_ROW || header.size < sizeof(header) + WAL_ROW_FIXED) {
+        return 0;
+    }
+    const char* p = data + sizeof(header);
+    uint8_t name_len = p[0];
+    uint8_t email_len = p[1];
+    if (name_len >= MAX_NAME_SIZE || email_len >= MAX_EMAIL_SIZE
+        || header.size != sizeof(header) + WAL_ROW_FIXED + name_len + email_len) {
+        return 0;
+    }
+    memcpy(record->row.name, p + WAL_ROW_FIXED, name_len);
+    memcpy(record->row.email, p + WAL_ROW_FIXED + name_len, email_len);
+    return header.size;
+}
+
+// Reads the records from the start of the log, calling apply (if not NULL) on each one with an LSN above
+// after_lsn, and stops at the first that is torn or corrupt. Sets *end to the LSN after the last good record;
+// returns the number of records applied (or read, without apply), -1 if apply failed.
+static long scan_log(Wal* wal, uint64_t after_lsn, int (*apply)(const WalRecord*, uint64_t, void*), void* arg, uint64_t* end) {
+    char* chunk = malloc(WAL_READ_CHUNK);
+    if (chunk == NULL) {
+        printf("Failed to allocate the log read buffer!\n");
+        *end = wal->base_lsn;
+        return -1;
+    }
+    long count = 0;
+    uint64_t lsn = wal->base_lsn;
+    off_t offset = sizeof(WalFileHeader); // File offset of chunk[0]
+    size_t len = 0, pos = 0;
+    bool eof = false;
+    while (true) {
+        if (!eof && len - pos < WAL_MAX_RECORD) { // Refill, keeping the partial record at the front
+            memmove(chunk, chunk + pos, len - pos);
+            offset += pos;
+            len -= pos;
+            pos = 0;
+            ssize_t n = pread(wal->fd, chunk + len, WAL_READ_CHUNK - len, offset + len);
+            if (n <= 0) {
+                eof = true;
+            } else {
+                len += n;
+            }
+        }
+        WalRecord record;
+        size_t size = decode_record(wal, chunk + pos, len - pos, &record);
+        if (size == 0) {
+            break;
+        }
+        pos += size;
+        lsn += size;
+        if (apply == NULL) {
+            count++;
+        } else if (lsn > after_lsn) {
+            count++;
+            if (apply(&record, lsn, arg) != 0) {
+                count = -1;
+                break;
+            }
+        }
+    }
+    free(chunk);
+    *end = lsn;
+    return count;
+}
+
+static int write_header(Wal* wal, uint64_t base_lsn) {
+    WalFileHeader header = { .magic = WAL_MAGIC, .version = WAL_VERSION, .base_lsn = base_lsn };
+    if (pwrite(wal->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || fdatasync(wal->fd) != 0) {
+        printf("Failed to write the log header!\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const char* data, size_t len, off_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(fd, data + done, len - done, offset + done);
+        if (n <= 0) {
+            return 1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+WalConfig wal_default_config(void) {
+    WalConfig config = {
+        .commit_delay_us = 0,
+        .checkpoint_bytes = WAL_CHECKPOINT_BYTES,
+        .checkpoint_interval_ms = WAL_CHECKPOINT_INTERVAL_MS
+    };
+    return config;
+}
+
+Wal* wal_open(const char* data_dir, const WalConfig* config) {
+    WalConfig defaults = wal_default_config();
+    if (config == NULL) {
+        config = &defaults;
+    }
+    pthread_once(&crc_once, crc_init);
+    Wal* wal = calloc(1, sizeof(Wal));
+    if (wal == NULL) {
+        printf("Failed to allocate memory for the log!\n");
+        return NULL;
+    }
+    snprintf(wal->path, sizeof(wal->path), "%s/%s", data_dir, WAL_FILE);
+    wal->commit_delay_us = config->commit_delay_us;
+    wal->checkpoint_bytes = config->checkpoint_bytes;
+    wal->checkpoint_interval_ms = config->checkpoint_interval_ms;
+    wal->truncated_ns = now_ns();
+    wal->buf_cap = wal->spare_cap = WAL_BUFFER_SIZE;
+    wal->buf = malloc(wal->buf_cap);
+    wal->spare = malloc(wal->spare_cap);
+    wal->fd = open(wal->path, O_RDWR | O_CREAT, 0644);
+    if (wal->buf == NULL || wal->spare == NULL || wal->fd < 0) {
+        printf("Failed to open log %s!\n", wal->path);
+        if (wal->fd >= 0) {
+            close(wal->fd);
+        }
+        free(wal->buf);
+        free(wal->spare);
+        free(wal);
+        return NULL;
+    }
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->synced, NULL);
+
+    WalFileHeader header;
+    ssize_t n = pread(wal->fd, &header, sizeof(header), 0);
+    if (n == (ssize_t)sizeof(header) && header.magic == WAL_MAGIC && (header.version == WAL_VERSION || header.version == 1)) {
+        // A version 1 log is replayed like any other, and is only appended to once a checkpoint empties it
+        // and so starts it over in the current format
+        wal->version = header.version;
+        wal->base_lsn = header.base_lsn;
+    } else if (n == (ssize_t)sizeof(header) && header.magic == WAL_MAGIC) {
+        printf("Log %s has unknown format version %u, refusing to open it\n", wal->path, header.version);
+        wal_close(wal);
+        return NULL;
+    } else if (write_header(wal, 0) != 0) { // New log
+        wal_close(wal);
+        return NULL;
+    } else {
+        wal->version = WAL_VERSION;
+    }
+    uint64_t end;
+    long records = scan_log(wal, 0, NULL, NULL, &end);
+    if (records < 0) {
+        wal_close(wal);
+        return NULL;
+    }
+    // Drop a torn tail, so later appends cannot leave an old record behind them that still checks out
+    if (ftruncate(wal->fd, lsn_offset(wal, end)) != 0 || fdatasync(wal->fd) != 0) {
+        printf("Failed to truncate log %s!\n", wal->path);
+        wal_close(wal);
+        return NULL;
+    }
+    wal->next_lsn = wal->durable_lsn = wal->file_end = end;
+    return wal;
+}
+
+void wal_close(Wal* wal) {
+    if (wal == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&wal->lock);
+    while (wal->syncing) {
+        pthread_cond_wait(&wal->synced, &wal->lock);
+    }
+    if (wal->buf_len > 0 && !wal->failed && !wal->deleted) {
+        write_all(wal->fd, wal->buf, wal->buf_len, lsn_offset(wal, wal->file_end));
+    }
+    pthread_mutex_unlock(&wal->lock);
+    close(wal->fd);
+    pthread_cond_destroy(&wal->synced);
+    pthread_mutex_destroy(&wal->lock);
+    free(wal->buf);
+    free(wal->spare);
+    free(wal);
+}
+
+uint64_t wal_append(Wal* wal, const WalRecord* record) {
+    if (wal == NULL || record == NULL) {
+        return 0;
+    }
+    char encoded[WAL_MAX_RECORD];
+    size_t size = encode_record(encoded, record);
+    pthread_mutex_lock(&wal->lock);
+    if (wal->failed || wal->deleted || wal->version != WAL_VERSION) {
+        pthread_mutex_unlock(&wal->lock);
+        return 0;
+    }
+    if (wal->buf_len + size > wal->buf_cap) {
+        char* grown = realloc(wal->buf, 2 * wal->buf_cap);
+        if (grown == NULL) {
+            printf("Failed to grow the log buffer!\n");
+            pthread_mutex_unlock(&wal->lock);
+            return 0;
+        }
+        wal->buf = grown;
+        wal->buf_cap *= 2;
+    }
+    memcpy(wal->buf + wal->buf_len, encoded, size);
+    wal->buf_len += size;
+    wal->next_lsn += size;
+    uint64_t lsn = wal->next_lsn;
+    wal->stats.records++;
+    wal->stats.bytes += size;
+    pthread_mutex_unlock(&wal->lock);
+    return lsn;
+}
+
+int wal_commit(Wal* wal, uint64_t lsn) {
+    if (wal == NULL) {
+        return 1;
+    }
+    pthread_mutex_lock(&wal->lock);
+    if (lsn > wal->next_lsn) {
+        lsn = wal->next_lsn;
+    }
+    if (wal->durable_lsn < lsn) {
+        wal->stats.commits++;
+    }
+    while (wal->durable_lsn < lsn && !wal->failed) {
+        if (wal->syncing) { // Another commit is syncing; ours is either in its group or goes in the next one
+            pthread_cond_wait(&wal->synced, &wal->lock);
+            continue;
+        }
+        // Lead the next group: everything appended so far is written and synced with one call each
+        wal->syncing = true;
+        if (wal->commit_delay_us > 0) {
+            pthread_mutex_unlock(&wal->lock);
+            usleep(wal->commit_delay_us); // Let concurrent writers append and join this group
+            pthread_mutex_lock(&wal->lock);
+        }
+        char* data = wal->buf;
+        size_t len = wal->buf_len;
+        size_t cap = wal->buf_cap;
+        uint64_t end = wal->next_lsn;
+        off_t offset = lsn_offset(wal, wal->file_end);
+        wal->buf = wal->spare;
+        wal->buf_cap = wal->spare_cap;
+        wal->buf_len = 0;
+        pthread_mutex_unlock(&wal->lock);
+
+        int failed = write_all(wal->fd, data, len, offset) != 0 || fdatasync(wal->fd) != 0;
+
+        pthread_mutex_lock(&wal->lock);
+        wal->spare = data;
+        wal->spare_cap = cap;
+        wal->syncing = false;
+        if (failed) {
+            printf("Failed to write log %s, changes are no longer durable!\n", wal->path);
+            wal->failed = true;
+        } else {
+            wal->file_end = end;
+            wal->durable_lsn = end;
+            wal->stats.syncs++;
+        }
+        pthread_cond_broadcast(&wal->synced);
+    }
+    int ret = wal->durable_lsn < lsn;
+    pthread_mutex_unlock(&wal->lock);
+    return ret;
+}
+
+long wal_replay(Wal* wal, uint64_t after_lsn, int (*apply)(const WalRecord* record, uint64_t lsn, void* arg), void* arg) {
+    if (wal == NULL || apply == NULL) {
+        return -1;
+    }
+    uint64_t end;
+    return scan_log(wal, after_lsn, apply, arg, &end);
+}
+
+static int sync_parent_dir(const char* path) {
+    char dir[256];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char* slash = strrchr(dir, '/');
+    if (slash == NULL) {
+        snprintf(dir, sizeof(dir), ".");
+    } else {
+        *slash = '\0';
+    }
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+    int ret = fsync(fd) != 0;
+    close(fd);
+    return ret;
+}
+
+// Writes the records after lsn into a new log starting at lsn and renames it over the old one, so a crash
+// leaves either log whole. Called with wal->lock held and no commit syncing.
+static int rewrite_log(Wal* wal, uint64_t lsn) {
+    char tmp_path[sizeof(wal->path) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", wal->path);
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    char* chunk = malloc(WAL_READ_CHUNK);
+    if (fd < 0 || chunk == NULL) {
+        printf("Failed to create %s!\n", tmp_path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(chunk);
+        return 1;
+    }
+    WalFileHeader header = { .magic = WAL_MAGIC, .version = WAL_VERSION, .base_lsn = lsn };
+    int failed = pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header);
+    off_t from = lsn_offset(wal, lsn), to = sizeof(header);
+    for (off_t end = lsn_offset(wal, wal->file_end); !failed && from < end; ) {
+        size_t want = end - from < WAL_READ_CHUNK ? (size_t)(end - from) : WAL_READ_CHUNK;
+        ssize_t n = pread(wal->fd, chunk, want, from);
+        failed = n <= 0 || write_all(fd, chunk, n, to) != 0;
+        from += n;
+        to += n;
+    }
+    free(chunk);
+    if (failed || fdatasync(fd) != 0 || rename(tmp_path, wal->path) != 0 || sync_parent_dir(wal->path) != 0) {
+        printf("Failed to truncate log %s!\n", wal->path);
+        close(fd);
+        remove(tmp_path);
+        return 1;
+    }
+    close(wal->fd);
+    wal->fd = fd;
+    wal->base_lsn = lsn;
+    wal->version = WAL_VERSION;
+    return 0;
+}
+
+int wal_truncate(Wal* wal, uint64_t lsn) {
+    if (wal == NULL) {
+        return 1;
+    }
+    pthread_mutex_lock(&wal->lock);
+    while (wal->syncing) {
+        pthread_cond_wait(&wal->synced, &wal->lock);
+    }
+    if (wal->deleted || lsn <= wal->base_lsn) {
+        pthread_mutex_unlock(&wal->lock);
+        return 0;
+    }
+    bool empty = lsn >= wal->next_lsn;
+    if (!empty && wal->version != WAL_VERSION) { // The records kept would be copied under a header of the current version
+        pthread_mutex_unlock(&wal->lock);
+        return 1;
+    }
+    if (!empty && lsn > wal->file_end) {
+        lsn = wal->file_end; // Records still in the buffer stay
+    }
+    int ret = rewrite_log(wal, lsn);
+    if (ret == 0) {
+        if (empty) { // Moved past everything appended, e.g. to the newest LSN found in the pages
+            wal->buf_len = 0;
+            wal->next_lsn = wal->durable_lsn = wal->file_end = lsn;
+            wal->failed = false;
+        }
+        wal->truncated_ns = now_ns();
+        wal->stats.truncations++;
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return ret;
+}
+
+bool wal_failed(Wal* wal) {
+    pthread_mutex_lock(&wal->lock);
+    bool failed = wal->failed || wal->deleted || wal->version != WAL_VERSION;
+    pthread_mutex_unlock(&wal->lock);
+    return failed;
+}
+
+uint64_t wal_end_lsn(Wal* wal) {
+    pthread_mutex_lock(&wal->lock);
+    uint64_t lsn = wal->next_lsn;
+    pthread_mutex_unlock(&wal->lock);
+    return lsn;
+}
+
+uint64_t wal_start_lsn(Wal* wal) {
+    pthread_mutex_lock(&wal->lock);
+    uint64_t lsn = wal->base_lsn;
+    pthread_mutex_unlock(&wal->lock);
+    return lsn;
+}
+
+bool wal_checkpoint_due(Wal* wal) {
+    if (wal == NULL) {
+        return false;
+    }
+    pthread_mutex_lock(&wal->lock);
+    uint64_t bytes = wal->next_lsn - wal->base_lsn;
+    bool due = (wal->checkpoint_bytes > 0 && bytes >= wal->checkpoint_bytes)
+        || (wal->checkpoint_interval_ms > 0 && bytes > 0 && now_ns() - wal->truncated_ns >= wal->checkpoint_interval_ms * 1000000ull);
+    pthread_mutex_unlock(&wal->lock);
+    return due;
+}
+
+void wal_get_stats(Wal* wal, WalStats* stats) {
+    if (wal == NULL || stats == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&wal->lock);
+    *stats = wal->stats;
+    stats->durable_lsn = wal->durable_lsn;
+    stats->log_bytes = lsn_offset(wal, wal->file_end);
+    pthread_mutex_unlock(&wal->lock);
+}
+
+int wal_delete_file(Wal* wal) {
+    if (wal == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&wal->lock);
+    while (wal->syncing) {
+        pthread_cond_wait(&wal->synced, &wal->lock);
+    }
+    wal->deleted = true;
+    int deleted = remove(wal->path) == 0;
+    pthread_mutex_unlock(&wal->lock);
+    return deleted;
+}
@@ -0,0 +1,144 @@
+#define _XOPEN_SOURCE 700 // For nftw
+// Upgrade test: `make test`
+// Writes a data directory the way the first builds did (one page_<id>.bin file per page, holding their Page struct
+// as is), then opens it with create_table and checks every row reads back, by id and by name, and that new rows
+// go into the converted pages' free slots.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "table.h"
+
+#define TEST_ROWS ((int64_t)NUM_ROWS_PAGE + 5) // A full page, and a second one with free slots
+#define TEST_DELETED 3 // Row deleted before the upgrade, leaving a hole in the first page
+
+// Page as the first builds wrote it: a byte per slot, then the counts, then the rows at byte 40
+typedef struct {
+    uint8_t row_exists[NUM_ROWS_PAGE];
+    size_t num_rows;
+    int page_id;
+} BaselineHeader;
+
+typedef struct {
+    BaselineHeader header;
+    Row rows[NUM_ROWS_PAGE];
+} BaselinePage;
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void)st; (void)flag; (void)ftw;
+    return remove(path);
+}
+
+static void fill_row(Row* row, int64_t id) {
+    memset(row, 0, sizeof(*row));
+    row->id = id;
+    snprintf(row->name, sizeof(row->name), "name%" PRId64, id);
+    // Long enough to reach the last bytes of the row, which the larger old header pushed furthest
+    memset(row->email, 'e', sizeof(row->email) - 8);
+    snprintf(row->email + sizeof(row->email) - 8, 8, "%" PRId64, id);
+}
+
+static int write_baseline_pages(void) {
+    BaselinePage page;
+    int page_id = 0;
+    for (int64_t id = 1; id <= TEST_ROWS; page_id++) {
+        memset(&page, 0, sizeof(page));
+        page.header.page_id = page_id;
+        for (size_t slot = 0; slot < NUM_ROWS_PAGE && id <= TEST_ROWS; slot++, id++) {
+            fill_row(&page.rows[slot], id);
+            if (id != TEST_DELETED) {
+                page.header.row_exists[slot] = 1;
+                page.header.num_rows++;
+            }
+        }
+        char filename[64];
+        snprintf(filename, sizeof(filename), "%s/page_%d.bin", TABLE_DATA_DIR, page_id);
+        FILE* file = fopen(filename, "wb");
+        if (file == NULL || fwrite(&page, sizeof(page), 1, file) != 1) {
+            printf("upgrade_test: failed to write %s\n", filename);
+            if (file != NULL) {
+                fclose(file);
+            }
+            return 1;
+        }
+        fclose(file);
+    }
+    return 0;
+}
+
+static int check_rows(Table* table, size_t inserted) { // inserted: rows added since the upgrade
+    int failures = 0;
+    for (int64_t id = 1; id <= TEST_ROWS; id++) {
+        Row expected, row;
+        fill_row(&expected, id);
+        int found = table_get_row(table, id, &row) == 0;
+        if (id == TEST_DELETED) {
+            if (found) {
+                printf("upgrade_test: deleted row %" PRId64 " came back\n", id);
+                failures++;
+            }
+            continue;
+        }
+        if (!found || memcmp(&row, &expected, sizeof(Row)) != 0) {
+            printf("upgrade_test: row %" PRId64 " %s\n", id, found ? "differs" : "is missing");
+            failures++;
+        }
+    }
+    RowLoc pos;
+    if (table_find_name(table, "name7", &pos) != 0 || pos.page_slot != 0 || pos.row_slot != 6) {
+        printf("upgrade_test: name7 not found at page 0, row 6\n");
+        failures++;
+    }
+    size_t expected_rows = (size_t)TEST_ROWS - 1 + inserted;
+    if (table->num_rows != expected_rows) {
+        printf("upgrade_test: %zu rows counted, expected %zu\n", table->num_rows, expected_rows);
+        failures++;
+    }
+    return failures;
+}
+
+int main(void) {
+    char dir[] = "/tmp/byod_upgrade_XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0 || mkdir(TABLE_DATA_DIR, 0755) != 0) {
+        printf("upgrade_test: failed to set up a data directory\n");
+        return 1;
+    }
+    if (write_baseline_pages() != 0) {
+        return 1;
+    }
+
+    Table* table = create_table(NULL, NULL);
+    if (table == NULL) {
+        printf("upgrade_test: create_table failed on baseline pages\n");
+        return 1;
+    }
+    int failures = check_rows(table, 0);
+    Row row;
+    fill_row(&row, 1000);
+    RowLoc pos;
+    // The hole left by the deleted row is the first free slot of the converted pages
+    if (table_insert(table, &row) != 0 || table_find_id(table, 1000, &pos) != 0 || pos.page_slot != 0 || pos.row_slot != TEST_DELETED - 1) {
+        printf("upgrade_test: new row did not fill the free slot of page 0\n");
+        failures++;
+    }
+    free_table(table);
+
+    // Reopened from the converted file, without the page files
+    table = create_table(NULL, NULL);
+    if (table == NULL) {
+        printf("upgrade_test: create_table failed on the converted data\n");
+        return 1;
+    }
+    failures += check_rows(table, 1) > 0 || table_get_row(table, 1000, &row) != 0;
+    free_table(table);
+    if (chdir("/") == 0) {
+        nftw(dir, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+    }
+
+    printf(failures ? "upgrade_test: FAILED\n" : "upgrade_test: OK\n");
+    return failures != 0;
+}